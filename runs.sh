@@ -23,6 +23,23 @@ function do_run() {
   # not setting TRAC_THRESHOLD disables minimum size for traced allocations
   # setting TRAC_PMEMDIR choses a persistent memkind, default is system ram
   # setting TRAC_PMEMSIZE specifies size of the allocated pmem resource
+  # setting TRAC_TRACEMODE=async writes compressed traces from a background thread
+  # setting TRAC_CLOCK=tsc timestamps events with the cycle counter, calibrated against CLOCK_MONOTONIC_RAW
+  # setting TRAC_BACKPRESSURE=drop discards trace records instead of waiting when async queues are full
+  # setting TRAC_UNWIND=fp|unwind|backtrace selects the stack unwinder, fp walks frame pointers
+  # setting TRAC_POLICY names a placement rule file choosing memkinds and page sizes by size, call site and thread (see tracealloc/src/policy.hpp)
+  # setting TRAC_META_NODE binds the tracer's own metadata to a NUMA node
+  # setting TRAC_SAMPLE_BYTES traces allocations with probability proportional to their size instead of by TRAC_THRESHOLD
+  # setting TRAC_MMAP_THRESHOLD maps traced allocations of at least this size directly (anonymous or in TRAC_PMEMDIR)
+  # setting TRAC_MAPS=trace|place also traces the program's own mmap/mremap/brk regions, place applies TRAC_POLICY pages and TRAC_NUMA to anonymous ones
+  # setting TRAC_NUMA=local|interleave|<node> places traced DRAM allocations per thread instead of the process wide numactl --membind
+  # setting TRAC_PREFAULT=sync|async populates traced allocations from TRAC_PREFAULT_SIZE bytes on with TRAC_PREFAULT_THREADS helpers pinned to their node
+  # setting TRAC_ACCESS_RATE samples accesses in software (TRAC_ACCESS_PAGES protected pages per interval) into access.log, where PMU events are unavailable
+  # setting TRAC_HEATMAP with TRAC_ACCESS_RATE aggregates the samples per that many milliseconds and TRAC_HEATMAP_BLOCK bytes into heatmap.log instead
+  # setting TRAC_DIRTY_EPOCH counts written pages per allocation every that many milliseconds from soft-dirty bits into dirty.log
+  # setting TRAC_RESIDENCY_PERIOD samples resident pages and their nodes of TRAC_RESIDENCY_ALLOCS allocations and at most TRAC_RESIDENCY_PAGES pages per that many milliseconds into residency.log
+  # setting TRAC_ROI=api|signal|<from>[:<to>] traces only inside regions of interest from tracealloc.h, TRAC_ROI_SIGNAL (default SIGUSR2) or that window in seconds
+  # setting TRAC_STATS=1 writes call counts and latency histograms of the interposer itself to stats.json
   if test -z "$DRY" -o "$DRY" -le "0"; then
     if test -n "$libtrac"; then
       TRACCMD="env LD_PRELOAD=$libtrac TRAC_LOGPATH=$out TRAC_THRESHOLD=0x1000"
@@ -0,0 +1,39 @@
+#pragma once
+
+// Scoping of tracing from within the traced program.
+// With TRAC_ROI set, allocations are only traced inside regions of interest,
+//   between trac_roi_begin() and trac_roi_end(). Between trac_pause() and
+//   trac_resume(), none are traced. Untraced allocations bypass the handlers,
+//   while traced ones can still be resized and freed at any time.
+// Boundaries are logged to roi.log in TRAC_LOGPATH with the timestamps of
+//   the decoded traces, so phases can be aligned in analysis.
+// trac_tag names the traced allocation starting at ptr, trac_tag_range any
+//   range of memory, in the trace. Names are interned, a NULL or empty name
+//   removes one, and a name passed again at the same address is looked up
+//   without locking, so tagging in allocation loops stays cheap.
+// The functions are declared weak, so programs link and run without
+//   libtracealloc preloaded; the TRAC_* macros then do nothing.
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void trac_roi_begin(const char * name) __attribute__((weak));
+void trac_roi_end(void) __attribute__((weak));
+void trac_pause(void) __attribute__((weak));
+void trac_resume(void) __attribute__((weak));
+void trac_tag(void * ptr, const char * name) __attribute__((weak));
+void trac_tag_range(void * ptr, size_t size, const char * name) __attribute__((weak));
+
+#ifdef __cplusplus
+}
+#endif
+
+#define TRAC_ROI_BEGIN(name) do { if (trac_roi_begin) trac_roi_begin(name); } while (0)
+#define TRAC_ROI_END()       do { if (trac_roi_end) trac_roi_end(); } while (0)
+#define TRAC_PAUSE()         do { if (trac_pause) trac_pause(); } while (0)
+#define TRAC_RESUME()        do { if (trac_resume) trac_resume(); } while (0)
+#define TRAC_TAG(ptr, name)  do { if (trac_tag) trac_tag(ptr, name); } while (0)
+#define TRAC_TAG_RANGE(ptr, size, name) do { if (trac_tag_range) trac_tag_range(ptr, size, name); } while (0)
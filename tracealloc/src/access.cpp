@@ -0,0 +1,302 @@
+#include "access.hpp"
+
+#include <algorithm>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "clock.hpp"
+#include "common.hpp"
+#include "heatmap.hpp"
+
+
+namespace trac
+{
+
+pthread_once_t AccessSampler::s_init = PTHREAD_ONCE_INIT;
+bool AccessSampler::s_active = false;
+volatile bool AccessSampler::s_stop = false;
+uint64_t AccessSampler::s_interval = 0;
+size_t AccessSampler::s_pages = 16;
+size_t AccessSampler::s_page = 4096;
+int AccessSampler::s_log = -1;
+pthread_t AccessSampler::s_thread;
+struct sigaction AccessSampler::s_previous;
+AccessSampler::Slot AccessSampler::s_slots[2][AccessSampler::MaxPages];
+size_t AccessSampler::s_generation = 0;
+AccessSampler::Sample AccessSampler::s_queue[AccessSampler::QueueSize];
+std::atomic<size_t> AccessSampler::s_head(0);
+std::atomic<size_t> AccessSampler::s_tail(0);
+std::atomic<uint64_t> AccessSampler::s_dropped(0);
+uint64_t AccessSampler::s_random = 0;
+size_t AccessSampler::s_total = 0;
+size_t AccessSampler::s_visited = 0;
+size_t AccessSampler::s_drawn = 0;
+size_t AccessSampler::s_picks[AccessSampler::MaxPages];
+
+void AccessSampler::init()
+{
+  const char * rate = getenv("TRAC_ACCESS_RATE");
+  const char * logpath = getenv("TRAC_LOGPATH");
+  if (!rate || !logpath || !strtod(rate, nullptr)) {
+    return;
+  }
+  s_interval = 1000000000ull / strtod(rate, nullptr);
+  const char * pages = getenv("TRAC_ACCESS_PAGES");
+  if (pages && strtoul(pages, nullptr, 0)) {
+    s_pages = std::min(strtoul(pages, nullptr, 0), MaxPages);
+  }
+  s_page = sysconf(_SC_PAGESIZE);
+  s_random = Clock::ns() | 1;
+
+  // with TRAC_HEATMAP, samples are only aggregated
+  if (!Heatmap::active()) {
+    char logfilename[256];
+    snprintf(logfilename, sizeof(logfilename), "%s/access.log", logpath);
+    s_log = open(logfilename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (s_log < 0) {
+      printf("TRAC_ACCESS_RATE: can not open %s\n", logfilename);
+      return;
+    }
+  }
+  struct sigaction action = {};
+  action.sa_sigaction = &onFault;
+  action.sa_flags = SA_SIGINFO | SA_RESTART | SA_ONSTACK;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGSEGV, &action, &s_previous);
+  s_active = true;
+  int err = pthread_create(&s_thread, nullptr, &samplerMain, nullptr);
+  if (err) {
+    printf("Access sampler error: %d\n", err);
+    s_active = false;
+    sigaction(SIGSEGV, &s_previous, nullptr);
+  }
+}
+
+void AccessSampler::begin()
+{
+  pthread_once(&s_init, init);
+}
+
+void AccessSampler::end()
+{
+  if (!s_active) {
+    return;
+  }
+  s_stop = true;
+  pthread_join(s_thread, nullptr);
+  disarm(0);
+  disarm(1);
+  drain();
+  s_active = false;
+  uint64_t dropped = s_dropped.load();
+  if (dropped) {
+    printf("TRAC_ACCESS:dropped=%lu\n", dropped);
+  }
+  if (s_log >= 0) {
+    close(s_log);
+    s_log = -1;
+  }
+}
+
+void AccessSampler::onFault(int signo, siginfo_t * info, void * context)
+{
+  uintptr_t page = (uintptr_t)info->si_addr & ~(s_page - 1);
+  bool known = false;
+  for (auto & generation : s_slots) {
+    for (Slot & slot : generation) {
+      // unused slots hold page 0
+      if (!page || slot.page.load(std::memory_order_acquire) != page) {
+        continue;
+      }
+      known = true;
+      uint8_t armed = Armed;
+      if (!slot.state.compare_exchange_strong(armed, Restoring)) {
+        continue; // restored meanwhile, or another armed copy of the page follows
+      }
+      mprotect((void *)page, s_page, PROT_READ | PROT_WRITE);
+      slot.state.store(Restored, std::memory_order_release);
+
+      size_t head = s_head.load(std::memory_order_relaxed);
+      do {
+        if (head - s_tail.load(std::memory_order_acquire) >= QueueSize) {
+          s_dropped.fetch_add(1, std::memory_order_relaxed);
+          return;
+        }
+      } while (!s_head.compare_exchange_weak(head, head + 1, std::memory_order_relaxed));
+      Sample & sample = s_queue[head % QueueSize];
+      sample.kind = 0;
+#if defined(__x86_64__)
+      // page fault error code, bit 1 is set for writes
+      sample.kind = (((ucontext_t *)context)->uc_mcontext.gregs[REG_ERR] & 2)? 2 : 1;
+#endif
+      sample.ns = Clock::ns();
+      sample.addr = (uintptr_t)info->si_addr;
+      sample.base = slot.base;
+      sample.tid = syscall(SYS_gettid);
+      sample.ready.store(true, std::memory_order_release);
+      return;
+    }
+  }
+  if (known) {
+    return; // the page is accessible again, retry
+  }
+  // not ours, hand over to whoever was there before
+  if (s_previous.sa_flags & SA_SIGINFO) {
+    s_previous.sa_sigaction(signo, info, context);
+  } else if (s_previous.sa_handler != SIG_DFL && s_previous.sa_handler != SIG_IGN) {
+    s_previous.sa_handler(signo);
+  } else {
+    // fault again with the default action
+    sigaction(SIGSEGV, &s_previous, nullptr);
+  }
+}
+
+bool AccessSampler::restore(Slot & slot)
+{
+  uint8_t armed = Armed;
+  if (!slot.state.compare_exchange_strong(armed, Restoring)) {
+    return false;
+  }
+  mprotect((void *)slot.page.load(std::memory_order_relaxed), s_page, PROT_READ | PROT_WRITE);
+  slot.state.store(Restored, std::memory_order_release);
+  return true;
+}
+
+void AccessSampler::disarm(size_t generation)
+{
+  for (Slot & slot : s_slots[generation % 2]) {
+    restore(slot);
+  }
+}
+
+void AccessSampler::release(uintptr_t base, size_t size)
+{
+  uintptr_t end = base + size;
+  for (auto & generation : s_slots) {
+    for (Slot & slot : generation) {
+      uintptr_t page = slot.page.load(std::memory_order_acquire);
+      if (page >= base && page < end) {
+        restore(slot);
+      }
+    }
+  }
+}
+
+static void pageRange(uintptr_t base, size_t size, size_t page, uintptr_t & first, size_t & count)
+{
+  // only pages lying entirely within the allocation, so no other data is protected
+  first = (base + page - 1) & ~(page - 1);
+  uintptr_t end = (base + size) & ~(page - 1);
+  count = (first < end)? (end - first) / page : 0;
+}
+
+void AccessSampler::countPages(uintptr_t base, const Registry::Alloc & info, void * data)
+{
+  uintptr_t first;
+  size_t count;
+  pageRange(base, info.size, s_page, first, count);
+  s_total += count;
+}
+
+void AccessSampler::armPages(uintptr_t base, const Registry::Alloc & info, void * data)
+{
+  // called holding the allocation's shard lock, so it can not be released meanwhile
+  uintptr_t first;
+  size_t count;
+  pageRange(base, info.size, s_page, first, count);
+  Slot * slots = s_slots[s_generation % 2];
+  for (; s_drawn < s_pages && s_picks[s_drawn] < s_visited + count; ++s_drawn) {
+    if (s_drawn && s_picks[s_drawn] == s_picks[s_drawn - 1]) {
+      continue;
+    }
+    uintptr_t page = first + (s_picks[s_drawn] - s_visited) * s_page;
+    Slot & slot = slots[s_drawn];
+    slot.base = base;
+    slot.page.store(page, std::memory_order_release);
+    slot.state.store(Armed, std::memory_order_release);
+    if (mprotect((void *)page, s_page, PROT_NONE)) {
+      slot.state.store(Free, std::memory_order_release); // e.g. hugetlb pages
+    }
+  }
+  s_visited += count;
+}
+
+void AccessSampler::arm()
+{
+  s_total = 0;
+  Registry::forEach(&countPages, nullptr);
+  if (!s_total) {
+    return;
+  }
+  for (size_t idx = 0; idx < s_pages; ++idx) {
+    s_random ^= s_random << 13;
+    s_random ^= s_random >> 7;
+    s_random ^= s_random << 17;
+    s_picks[idx] = s_random % s_total;
+  }
+  std::sort(s_picks, s_picks + s_pages);
+  // the generation about to be reused was restored an interval ago
+  for (Slot & slot : s_slots[s_generation % 2]) {
+    slot.state.store(Free, std::memory_order_release);
+    slot.page.store(0, std::memory_order_release);
+  }
+  s_visited = 0;
+  s_drawn = 0;
+  // allocations registered since counting just shift which pages are picked
+  Registry::forEach(&armPages, nullptr);
+}
+
+void AccessSampler::drain()
+{
+  char buffer[1 << 14];
+  size_t fill = 0;
+  size_t tail = s_tail.load(std::memory_order_relaxed);
+  size_t head = s_head.load(std::memory_order_acquire);
+  for (; tail < head; ++tail) {
+    Sample & sample = s_queue[tail % QueueSize];
+    if (!sample.ready.load(std::memory_order_acquire)) {
+      break; // still being written, next time
+    }
+    if (s_log < 0) {
+      Heatmap::add(sample.ns, sample.addr, sample.base, sample.kind);
+      sample.ready.store(false, std::memory_order_relaxed);
+      continue;
+    }
+    static const char * const kinds[] = {"sw_access", "sw_read", "sw_write"};
+    fill += snprintf(buffer + fill, sizeof(buffer) - fill, "%lu.%09lu: %s: %lx %u %lx\n",
+                     sample.ns / 1000000000ul, sample.ns % 1000000000ul, kinds[sample.kind],
+                     sample.addr, sample.tid, sample.base);
+    sample.ready.store(false, std::memory_order_relaxed);
+    if (sizeof(buffer) - fill < 128) {
+      write(s_log, buffer, fill);
+      fill = 0;
+    }
+  }
+  s_tail.store(tail, std::memory_order_release);
+  if (fill) {
+    write(s_log, buffer, fill);
+  }
+}
+
+void * AccessSampler::samplerMain(void * arg)
+{
+  setInternalThread();
+  struct timespec interval = {(time_t)(s_interval / 1000000000ull), (long)(s_interval % 1000000000ull)};
+  while (!s_stop) {
+    nanosleep(&interval, nullptr);
+    disarm(s_generation);
+    ++s_generation;
+    arm();
+    drain();
+  }
+  return nullptr;
+}
+
+} // namespace trac
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <signal.h>
+
+#include "registry.hpp"
+
+
+namespace trac
+{
+
+// Software access sampling for machines without usable PMU events.
+// TRAC_ACCESS_RATE times per second, TRAC_ACCESS_PAGES (default 16) pages
+//   chosen uniformly among the pages of registered allocations are protected
+//   with PROT_NONE. The first access faults, the SIGSEGV handler records
+//   time, address, thread and allocation, and restores access. Pages not
+//   accessed until the next interval are restored before new ones are armed.
+// Samples go to access.log in TRAC_LOGPATH, one per line:
+//   <sec.nsec>: <sw_read|sw_write|sw_access>: <address> <tid> <allocation>
+//   with the CLOCK_MONOTONIC_RAW time of the decoded allocation traces,
+//   or are aggregated by Heatmap with TRAC_HEATMAP.
+// System calls reading or writing an armed page fail with EFAULT instead of
+//   faulting, and applications installing their own SIGSEGV handler after
+//   startup or protecting their own heap pages are not supported.
+class AccessSampler
+{
+public:
+  static constexpr size_t MaxPages = 256;      // per interval
+  static constexpr size_t QueueSize = 1ul << 12;
+
+private:
+  enum State : uint8_t
+  {
+    Free,
+    Armed,
+    Restoring,
+    Restored,
+  };
+
+  struct Slot
+  {
+    std::atomic<uintptr_t> page;
+    std::atomic<uint8_t> state;
+    uintptr_t base;
+  };
+
+  struct Sample
+  {
+    std::atomic<bool> ready;
+    uint8_t kind;     // 0 unknown, 1 read, 2 write
+    uint64_t ns;
+    uintptr_t addr;
+    uintptr_t base;
+    uint32_t tid;
+  };
+
+  static pthread_once_t s_init;
+  static bool s_active;
+  static volatile bool s_stop;
+  static uint64_t s_interval; // in ns
+  static size_t s_pages;
+  static size_t s_page;
+  static int s_log;
+  static pthread_t s_thread;
+  static struct sigaction s_previous;
+
+  // two generations, so pages of the previous interval are still known
+  //   while a fault on them is handled
+  static Slot s_slots[2][MaxPages];
+  static size_t s_generation;
+
+  static Sample s_queue[QueueSize];
+  static std::atomic<size_t> s_head;
+  static std::atomic<size_t> s_tail;
+  static std::atomic<uint64_t> s_dropped;
+
+  // interval state of the sampler thread
+  static uint64_t s_random;
+  static size_t s_total;
+  static size_t s_visited;
+  static size_t s_drawn;
+  static size_t s_picks[MaxPages];
+
+  static void init();
+  static void * samplerMain(void * arg);
+  static void onFault(int signo, siginfo_t * info, void * context);
+  static bool restore(Slot & slot);
+  static void disarm(size_t generation);
+  static void arm();
+  static void countPages(uintptr_t base, const Registry::Alloc & info, void * data);
+  static void armPages(uintptr_t base, const Registry::Alloc & info, void * data);
+  static void drain();
+
+public:
+  static void begin();
+  static void end();
+
+  static bool active() { return s_active; }
+  // must precede freeing or resizing an allocation while active
+  static void release(uintptr_t base, size_t size);
+};
+
+} // namespace trac
@@ -0,0 +1,131 @@
+#include "arena.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <linux/mempolicy.h>
+
+
+namespace trac
+{
+
+pthread_mutex_t Arena::s_guard = PTHREAD_MUTEX_INITIALIZER;
+pthread_once_t Arena::s_init = PTHREAD_ONCE_INIT;
+int Arena::s_node = -1;
+Arena::FreeBlock * Arena::s_free[Arena::ClassCount] = { nullptr };
+char * Arena::s_chunkPos = nullptr;
+char * Arena::s_chunkEnd = nullptr;
+size_t Arena::s_mapped = 0;
+size_t Arena::s_used = 0;
+size_t Arena::s_peak = 0;
+
+void Arena::init()
+{
+  const char * node = getenv("TRAC_META_NODE");
+  if (node) {
+    s_node = strtol(node, nullptr, 0);
+  }
+}
+
+void * Arena::map(size_t size) // must be called holding s_guard
+{
+  void * mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    return nullptr;
+  }
+  if (s_node >= 0 && s_node < 64) {
+    // raw syscall, to avoid depending on libnuma for this alone
+    unsigned long mask = 1ul << s_node;
+    if (syscall(SYS_mbind, mem, size, MPOL_BIND, &mask, 64, 0)) {
+      printf("TRAC_META_NODE=%d can not be bound, using default policy\n", s_node);
+      s_node = -1;
+    }
+  }
+  s_mapped += size;
+  return mem;
+}
+
+size_t Arena::sizeClass(size_t size)
+{
+  if (size <= (1ul << MinShift)) {
+    return 0;
+  }
+  return 64 - __builtin_clzl(size - 1) - MinShift;
+}
+
+void * Arena::allocate(size_t size)
+{
+  pthread_once(&s_init, init);
+  if (!size) {
+    size = 1;
+  }
+  void * res = nullptr;
+  pthread_mutex_lock(&s_guard);
+  if (size > MaxBlock) {
+    size = (size + PageSize - 1) & ~(PageSize - 1);
+    res = map(size);
+  } else {
+    size_t cls = sizeClass(size);
+    size = 1ul << (cls + MinShift);
+    if (s_free[cls]) {
+      res = s_free[cls];
+      s_free[cls] = s_free[cls]->next;
+    } else {
+      size_t bound = (size < PageSize)? size : PageSize;
+      char * pos = (char *)(((uintptr_t)s_chunkPos + bound - 1) & ~(bound - 1));
+      if (!s_chunkPos || pos + size > s_chunkEnd) {
+        // the rest of the previous chunk is wasted, at most MaxBlock bytes
+        pos = (char *)map(ChunkSize);
+        s_chunkEnd = pos? pos + ChunkSize : nullptr;
+      }
+      if (pos) {
+        s_chunkPos = pos + size;
+        res = pos;
+      }
+    }
+  }
+  if (res) {
+    s_used += size;
+    if (s_used > s_peak) {
+      s_peak = s_used;
+    }
+  }
+  pthread_mutex_unlock(&s_guard);
+  return res;
+}
+
+void Arena::deallocate(void * ptr, size_t size)
+{
+  if (!ptr) {
+    return;
+  }
+  if (!size) {
+    size = 1;
+  }
+  pthread_mutex_lock(&s_guard);
+  if (size > MaxBlock) {
+    size = (size + PageSize - 1) & ~(PageSize - 1);
+    munmap(ptr, size);
+    s_mapped -= size;
+  } else {
+    size_t cls = sizeClass(size);
+    size = 1ul << (cls + MinShift);
+    FreeBlock * block = (FreeBlock *)ptr;
+    block->next = s_free[cls];
+    s_free[cls] = block;
+  }
+  s_used -= size;
+  pthread_mutex_unlock(&s_guard);
+}
+
+void Arena::report()
+{
+  pthread_mutex_lock(&s_guard);
+  printf("TRAC_META:mapped=%ld:used=%ld:peak=%ld:node=%d\n", s_mapped, s_used, s_peak, s_node);
+  pthread_mutex_unlock(&s_guard);
+}
+
+} // namespace trac
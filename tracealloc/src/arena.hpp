@@ -0,0 +1,90 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+
+namespace trac
+{
+
+// Backs the tracer's own data structures with memory mapped separately from
+//   the workload's heap, so they neither show up between its objects nor
+//   share its cache lines. Requests up to MaxBlock bytes are served from
+//   power of two size classes carved out of ChunkSize mappings (blocks are
+//   aligned to their class, up to the page size), larger ones are mapped
+//   directly. TRAC_META_NODE binds the mappings to a NUMA node.
+class Arena
+{
+  static constexpr size_t MinShift = 4;
+  static constexpr size_t MaxShift = 16;
+  static constexpr size_t ClassCount = MaxShift - MinShift + 1;
+  static constexpr size_t MaxBlock = 1ul << MaxShift;
+  static constexpr size_t ChunkSize = 1ul << 20;
+  static constexpr size_t PageSize = 4096;
+
+  struct FreeBlock
+  {
+    FreeBlock * next;
+  };
+
+  static pthread_mutex_t s_guard;
+  static pthread_once_t s_init;
+  static int s_node;
+  static FreeBlock * s_free[ClassCount];
+  static char * s_chunkPos;
+  static char * s_chunkEnd;
+  static size_t s_mapped;
+  static size_t s_used;
+  static size_t s_peak;
+
+  static void init();
+  static void * map(size_t size);
+  static size_t sizeClass(size_t size);
+
+public:
+  static void * allocate(size_t size);
+  static void deallocate(void * ptr, size_t size);
+
+  static void report();
+};
+
+// Base for tracer objects created with new, placing them in the Arena.
+// new yields nullptr without constructing when the Arena is exhausted.
+struct ArenaObject
+{
+  static void * operator new(size_t size) noexcept { return Arena::allocate(size); }
+  static void operator delete(void * ptr, size_t size) { Arena::deallocate(ptr, size); }
+};
+
+template<typename T>
+struct ArenaAllocator
+{
+  typedef T value_type;
+
+  ArenaAllocator() = default;
+  template<typename U>
+  ArenaAllocator(const ArenaAllocator<U> &) { }
+
+  T * allocate(size_t count) { return (T *)Arena::allocate(count * sizeof(T)); }
+  void deallocate(T * ptr, size_t count) { Arena::deallocate(ptr, count * sizeof(T)); }
+
+  template<typename U>
+  bool operator==(const ArenaAllocator<U> &) const { return true; }
+  template<typename U>
+  bool operator!=(const ArenaAllocator<U> &) const { return false; }
+};
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+template<typename K, typename V>
+using ArenaMap = std::map<K, V, std::less<K>, ArenaAllocator<std::pair<const K, V>>>;
+
+using ArenaString = std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>;
+
+} // namespace trac
@@ -0,0 +1,65 @@
+#include "clock.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+namespace trac
+{
+
+bool Clock::s_ticks = false;
+Clock::Sync Clock::s_syncs[Clock::MaxSyncs];
+size_t Clock::s_syncCount = 0;
+
+Clock::Sync Clock::sync()
+{
+  // bracket the tick reading by two clock readings and keep the tightest attempt
+  Sync best = {0, 0};
+  uint64_t window = ~0ull;
+  for (int i = 0; i < 8; ++i) {
+    uint64_t before = ns();
+    uint64_t tick = ticks();
+    uint64_t after = ns();
+    if (after - before < window) {
+      window = after - before;
+      best.ticks = tick;
+      best.ns = before + window / 2;
+    }
+  }
+  return best;
+}
+
+void Clock::addSync()
+{
+  if (s_syncCount < MaxSyncs) {
+    s_syncs[s_syncCount++] = sync();
+  }
+}
+
+void Clock::begin()
+{
+  const char * clock = getenv("TRAC_CLOCK");
+  if (!clock || strcmp(clock, "tsc") != 0) {
+    return;
+  }
+  if (!ticks()) {
+    printf("TRAC_CLOCK=tsc not supported on this platform, using CLOCK_MONOTONIC_RAW\n");
+    return;
+  }
+  s_ticks = true;
+  // two points a short while apart allow conversion even if TRAC_END is never reached
+  addSync();
+  const struct timespec span = {0, 10000000};
+  nanosleep(&span, nullptr);
+  addSync();
+}
+
+void Clock::end()
+{
+  if (s_ticks) {
+    addSync();
+  }
+}
+
+} // namespace trac
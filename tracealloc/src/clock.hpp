@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+
+namespace trac
+{
+
+// Source of event timestamps.
+// Defaults to nanoseconds of CLOCK_MONOTONIC_RAW. With TRAC_CLOCK=tsc, raw
+//   cycle counter ticks (rdtsc on x86, mftb on POWER) are used instead and
+//   Sync points taken at TRAC_BEG/TRAC_END map them to CLOCK_MONOTONIC_RAW.
+class Clock
+{
+public:
+  struct Sync
+  {
+    uint64_t ticks;
+    uint64_t ns;
+  };
+
+  static constexpr size_t MaxSyncs = 4;
+
+private:
+  static bool s_ticks;
+  static Sync s_syncs[MaxSyncs];
+  static size_t s_syncCount;
+
+  static Sync sync();
+  static void addSync();
+
+public:
+  static void begin();
+  static void end();
+
+  static bool usesTicks() { return s_ticks; }
+  static const Sync * syncs(size_t & count) { count = s_syncCount; return s_syncs; }
+
+  static inline uint64_t ns()
+  {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    return now.tv_sec * 1000000000ull + now.tv_nsec;
+  }
+
+  static inline uint64_t ticks()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__powerpc64__) || defined(__powerpc__)
+    return __builtin_ppc_get_timebase();
+#elif defined(__aarch64__)
+    uint64_t value;
+    __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (value));
+    return value;
+#else
+    return 0;
+#endif
+  }
+
+  static inline uint64_t now()
+  {
+    return s_ticks? ticks() : ns();
+  }
+};
+
+} // namespace trac
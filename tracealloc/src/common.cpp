@@ -3,6 +3,9 @@
 #include <dlfcn.h>
 #include <errno.h>
 #include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #include <atomic>
 
@@ -24,6 +27,11 @@ int    (*g_orig_posix_memalign)(void ** pptr, size_t bound, size_t size) = nullp
 void * (*g_orig_realloc)(void * ptr, size_t size) = nullptr;
 void   (*g_orig_free)(void * ptr) = nullptr;
 size_t (*g_orig_malloc_usable_size)(void * ptr) = nullptr;
+void * (*g_orig_mmap)(void * addr, size_t length, int prot, int flags, int fd, off_t offset) = nullptr;
+int    (*g_orig_munmap)(void * addr, size_t length) = nullptr;
+void * (*g_orig_mremap)(void * addr, size_t oldsize, size_t size, int flags, ...) = nullptr;
+int    (*g_orig_brk)(void * addr) = nullptr;
+void * (*g_orig_sbrk)(intptr_t increment) = nullptr;
 
 std::atomic_bool g_haveOrig(false);
 
@@ -51,6 +59,11 @@ void initOrig() // must be called holding g_initOrigMutex
   g_orig_realloc            = (void * (*)(void *, size_t))          dlsym(RTLD_NEXT, "realloc");
   g_orig_free               = (void   (*)(void *))                  dlsym(RTLD_NEXT, "free");
   g_orig_malloc_usable_size = (size_t (*)(void *))                  dlsym(RTLD_NEXT, "malloc_usable_size");
+  g_orig_mmap               = (void * (*)(void *, size_t, int, int, int, off_t)) dlsym(RTLD_NEXT, "mmap");
+  g_orig_munmap             = (int    (*)(void *, size_t))          dlsym(RTLD_NEXT, "munmap");
+  g_orig_mremap             = (void * (*)(void *, size_t, size_t, int, ...)) dlsym(RTLD_NEXT, "mremap");
+  g_orig_brk                = (int    (*)(void *))                  dlsym(RTLD_NEXT, "brk");
+  g_orig_sbrk               = (void * (*)(intptr_t))                dlsym(RTLD_NEXT, "sbrk");
   g_recurse = false;
   g_haveOrig = true;
 }
@@ -251,5 +264,94 @@ size_t orig_malloc_usable_size(void * ptr)
   }
 }
 
+// mappings requested while resolving the originals go to the kernel directly,
+//   the program break is left alone, as glibc caches it
+void * orig_mmap(void * addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+  if (g_haveOrig) {
+    return g_orig_mmap(addr, length, prot, flags, fd, offset);
+  } else {
+    pthread_once(&g_initMutexOnce, initMutex);
+    pthread_mutex_lock(&g_initOrigMutex);
+    if (g_recurse) {
+      return (void *)syscall(SYS_mmap, addr, length, prot, flags, fd, offset);
+    } else if (!g_haveOrig) {
+      initOrig();
+    }
+    pthread_mutex_unlock(&g_initOrigMutex);
+    return g_orig_mmap(addr, length, prot, flags, fd, offset);
+  }
+}
+
+int    orig_munmap(void * addr, size_t length)
+{
+  if (g_haveOrig) {
+    return g_orig_munmap(addr, length);
+  } else {
+    pthread_once(&g_initMutexOnce, initMutex);
+    pthread_mutex_lock(&g_initOrigMutex);
+    if (g_recurse) {
+      return syscall(SYS_munmap, addr, length);
+    } else if (!g_haveOrig) {
+      initOrig();
+    }
+    pthread_mutex_unlock(&g_initOrigMutex);
+    return g_orig_munmap(addr, length);
+  }
+}
+
+void * orig_mremap(void * addr, size_t oldsize, size_t size, int flags, void * newaddr)
+{
+  if (g_haveOrig) {
+    return g_orig_mremap(addr, oldsize, size, flags, newaddr);
+  } else {
+    pthread_once(&g_initMutexOnce, initMutex);
+    pthread_mutex_lock(&g_initOrigMutex);
+    if (g_recurse) {
+      return (void *)syscall(SYS_mremap, addr, oldsize, size, flags, newaddr);
+    } else if (!g_haveOrig) {
+      initOrig();
+    }
+    pthread_mutex_unlock(&g_initOrigMutex);
+    return g_orig_mremap(addr, oldsize, size, flags, newaddr);
+  }
+}
+
+int    orig_brk(void * addr)
+{
+  if (g_haveOrig) {
+    return g_orig_brk(addr);
+  } else {
+    pthread_once(&g_initMutexOnce, initMutex);
+    pthread_mutex_lock(&g_initOrigMutex);
+    if (g_recurse) {
+      errno = ENOMEM;
+      return -1;
+    } else if (!g_haveOrig) {
+      initOrig();
+    }
+    pthread_mutex_unlock(&g_initOrigMutex);
+    return g_orig_brk(addr);
+  }
+}
+
+void * orig_sbrk(intptr_t increment)
+{
+  if (g_haveOrig) {
+    return g_orig_sbrk(increment);
+  } else {
+    pthread_once(&g_initMutexOnce, initMutex);
+    pthread_mutex_lock(&g_initOrigMutex);
+    if (g_recurse) {
+      errno = ENOMEM;
+      return (void *)-1;
+    } else if (!g_haveOrig) {
+      initOrig();
+    }
+    pthread_mutex_unlock(&g_initOrigMutex);
+    return g_orig_sbrk(increment);
+  }
+}
+
 
 } // namespace trac
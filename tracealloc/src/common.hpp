@@ -2,6 +2,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <sys/types.h>
 
 
 // extern "C" void*  __libc_malloc(size_t);
@@ -35,8 +36,17 @@ void * orig_realloc(void * ptr, size_t size);
 void   orig_free(void * ptr);
 size_t orig_malloc_usable_size(void * ptr);
 
+void * orig_mmap(void * addr, size_t length, int prot, int flags, int fd, off_t offset);
+int    orig_munmap(void * addr, size_t length);
+void * orig_mremap(void * addr, size_t oldsize, size_t size, int flags, void * newaddr);
+int    orig_brk(void * addr);
+void * orig_sbrk(intptr_t increment);
+
 bool check_fallback(void * ptr);
 
+// marks the calling thread as part of the tracer, so its allocations bypass the handlers
+void setInternalThread();
+
 } // namespace trac
 
 
@@ -0,0 +1,132 @@
+#include "directmap.hpp"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <new>
+
+
+namespace trac
+{
+
+char DirectMap::s_anonymousTag = 0;
+char DirectMap::s_fileTag = 0;
+
+pthread_once_t DirectMap::s_init = PTHREAD_ONCE_INIT;
+const char * DirectMap::s_dir = nullptr;
+pthread_mutex_t DirectMap::s_filesGuard = PTHREAD_MUTEX_INITIALIZER;
+DirectMap::Files * DirectMap::s_files = nullptr;
+
+static size_t pages(size_t size)
+{
+  return (size + DirectMap::PageSize - 1) & ~(DirectMap::PageSize - 1);
+}
+
+void DirectMap::init()
+{
+  s_dir = getenv("TRAC_PMEMDIR");
+  s_files = new (Arena::allocate(sizeof(Files))) Files();
+}
+
+int DirectMap::createFile(size_t size)
+{
+  int fd = open(s_dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    // file systems without O_TMPFILE support
+    char path[256];
+    snprintf(path, sizeof(path), "%s/trac_XXXXXX", s_dir);
+    fd = mkostemp(path, O_CLOEXEC);
+    if (fd >= 0) {
+      unlink(path);
+    }
+  }
+  if (fd >= 0 && ftruncate(fd, size)) {
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+void * DirectMap::map(memkind_t kind, size_t size)
+{
+  pthread_once(&s_init, init);
+  size = pages(size);
+  void * ptr;
+  if (kind == file()) {
+    int fd = s_dir? createFile(size) : -1;
+    if (fd < 0) {
+      return nullptr;
+    }
+    ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) {
+      close(fd);
+      return nullptr;
+    }
+    putFile((uintptr_t)ptr, fd);
+  } else {
+    ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+      return nullptr;
+    }
+  }
+  return ptr;
+}
+
+void * DirectMap::remap(memkind_t kind, void * ptr, size_t oldsize, size_t size)
+{
+  oldsize = pages(oldsize);
+  size = pages(size);
+  if (size == oldsize) {
+    return ptr;
+  }
+  if (kind != file()) {
+    void * res = mremap(ptr, oldsize, size, MREMAP_MAYMOVE);
+    return (res != MAP_FAILED)? res : nullptr;
+  }
+  int fd = takeFile((uintptr_t)ptr);
+  if (fd < 0) {
+    return nullptr;
+  }
+  // the file must cover the mapping at all times, when shrinking it keeps its size until unmap
+  void * res = (size > oldsize && ftruncate(fd, size))? MAP_FAILED : mremap(ptr, oldsize, size, MREMAP_MAYMOVE);
+  if (res == MAP_FAILED) {
+    putFile((uintptr_t)ptr, fd);
+    return nullptr;
+  }
+  putFile((uintptr_t)res, fd);
+  return res;
+}
+
+void DirectMap::unmap(memkind_t kind, void * ptr, size_t size)
+{
+  int fd = (kind == file())? takeFile((uintptr_t)ptr) : -1;
+  munmap(ptr, pages(size));
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+void DirectMap::putFile(uintptr_t base, int fd)
+{
+  pthread_mutex_lock(&s_filesGuard);
+  (*s_files)[base] = fd;
+  pthread_mutex_unlock(&s_filesGuard);
+}
+
+int DirectMap::takeFile(uintptr_t base)
+{
+  int fd = -1;
+  pthread_mutex_lock(&s_filesGuard);
+  auto it = s_files->find(base);
+  if (it != s_files->end()) {
+    fd = it->second;
+    s_files->erase(it);
+  }
+  pthread_mutex_unlock(&s_filesGuard);
+  return fd;
+}
+
+} // namespace trac
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <memkind.h>
+
+#include "arena.hpp"
+
+
+namespace trac
+{
+
+// Page granular allocations mapped directly instead of through memkind,
+//   used for sizes from TRAC_MMAP_THRESHOLD on. Anonymous mappings back DRAM,
+//   unlinked files in TRAC_PMEMDIR back pmem. Fresh mappings are zero filled
+//   and resizing remaps pages instead of copying them.
+// The two backings are represented by tag kinds, which the Registry stores
+//   like any memkind_t, but which must never be passed to memkind itself.
+class DirectMap
+{
+  typedef ArenaMap<uintptr_t, int> Files;
+
+  static char s_anonymousTag;
+  static char s_fileTag;
+
+  static pthread_once_t s_init;
+  static const char * s_dir;
+  static pthread_mutex_t s_filesGuard;
+  static Files * s_files; // descriptors of file backed mappings by base
+
+  static void init();
+  static int createFile(size_t size);
+  // descriptors are taken out while their address is released, so a mapping
+  //   reusing it meanwhile can not be mixed up with them
+  static void putFile(uintptr_t base, int fd);
+  static int takeFile(uintptr_t base);
+
+public:
+  static constexpr size_t PageSize = 4096;
+
+  static memkind_t anonymous() { return (memkind_t)&s_anonymousTag; }
+  static memkind_t file() { return (memkind_t)&s_fileTag; }
+  static bool owns(memkind_t kind) { return kind == anonymous() || kind == file(); }
+
+  static void * map(memkind_t kind, size_t size);
+  static void * remap(memkind_t kind, void * ptr, size_t oldsize, size_t size);
+  static void unmap(memkind_t kind, void * ptr, size_t size);
+};
+
+} // namespace trac
@@ -1,17 +1,22 @@
 #include "handler.hpp"
 
+#include "access.hpp"
+#include "clock.hpp"
+#include "roi.hpp"
+#include "stacks.hpp"
+#include "tags.hpp"
+
 #include <alloca.h>
+#include <errno.h>
+#include <math.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <time.h>
 #include <unistd.h>
 
-// #include <endian.h>
-//#define UNW_LOCAL_ONLY
-//#include <libunwind.h>
-#include <execinfo.h>
 
 
 namespace trac
@@ -21,36 +26,119 @@ memkind_t Handler::s_memkind = nullptr;
 pthread_once_t Handler::s_memkindCreate = PTHREAD_ONCE_INIT;
 pthread_once_t Handler::s_memkindDestroy = PTHREAD_ONCE_INIT;
 
-std::vector<Handler *> Handler::s_handlers;
+uint8_t Handler::s_pageShift = 12;
+uint8_t Handler::s_thpShift = 21;
+uint8_t Handler::s_hugetlbShift = 21;
+pthread_once_t Handler::s_pageSizesInit = PTHREAD_ONCE_INIT;
+
+ArenaVector<Handler *> Handler::s_handlers;
+ArenaVector<uint32_t> Handler::s_incarnations;
+ArenaVector<size_t> Handler::s_freeSlots;
+Handler * Handler::s_shared = nullptr;
+bool Handler::s_ended = false;
 
 pthread_mutex_t Handler::s_createGuard = PTHREAD_MUTEX_INITIALIZER;
 
 Handler * Handler::get()
 {
   pthread_mutex_lock(&s_createGuard);
-  Handler * handler = new Handler(s_handlers.size());
-  s_handlers.push_back(handler);
+  size_t slot;
+  if (!s_freeSlots.empty()) {
+    slot = s_freeSlots.back();
+    s_freeSlots.pop_back();
+  } else {
+    slot = s_handlers.size();
+    s_handlers.push_back(nullptr);
+    s_incarnations.push_back(0);
+  }
+  uint32_t incarnation = ++s_incarnations[slot];
+  Handler * handler = new Handler(slot, (slot & SlotMask) | (incarnation << SlotBits), gettid());
+  if (!handler) {
+    // without a handler the thread's allocations can not be followed
+    printf("TRAC: out of memory for the handler of thread %d\n", gettid());
+    abort();
+  }
+  s_handlers[slot] = handler;
   pthread_mutex_unlock(&s_createGuard);
+  Stats::setLocal(handler->m_stats);
   return handler;
 }
 
+void Handler::retire(Handler * handler)
+{
+  pthread_mutex_lock(&s_createGuard);
+  if (s_ended) {
+    // already closed by end()
+    pthread_mutex_unlock(&s_createGuard);
+    return;
+  }
+  s_handlers[handler->m_id] = nullptr;
+  // slots are reused until their incarnation runs out, so owners stay unique
+  if (s_incarnations[handler->m_id] < MaxIncarnation) {
+    s_freeSlots.push_back(handler->m_id);
+  }
+  pthread_mutex_unlock(&s_createGuard);
+  // unlinked, so closing the trace and waiting for prefaults does not hold up other threads
+  handler->onEnd();
+  Stats::retire(handler->m_stats);
+  handler->m_stats = nullptr;
+  delete handler;
+}
+
 void Handler::end()
 {
+  pthread_mutex_lock(&s_createGuard);
+  s_ended = true;
+  Registry::forEach(&endAlloc, nullptr);
+  MapRegistry::forEach(&endRegion, nullptr);
   for (Handler * handler : s_handlers) {
-    handler->onEnd();
+    if (handler) {
+      // the thread may still be inside the handler, so its counters stay allocated
+      handler->onEnd();
+      Stats::merge(handler->m_stats);
+    }
+  }
+  if (s_shared) {
+    s_shared->onEnd();
+    Stats::merge(s_shared->m_stats);
   }
   s_handlers.clear();
+  pthread_mutex_unlock(&s_createGuard);
   pthread_once(&s_memkindDestroy, destroyMemkind);
+  Policy::end();
 }
 
-Handler * Handler::globalAllocLookup(uintptr_t base, Alloc & info, Handler * exclude)
+Handler * Handler::ownerOf(uint32_t owner) // called holding s_createGuard
 {
-  for (Handler * handler : s_handlers) {
-    if (handler != exclude && handler->localAllocLookup(base, info)) {
-      return handler;
+  uint32_t slot = owner & SlotMask;
+  Handler * handler = (slot < s_handlers.size())? s_handlers[slot] : nullptr;
+  if (!handler || handler->m_owner != owner) {
+    // the allocating thread has exited, its leftovers go to alloc_<slots>_0.trc
+    if (!s_shared) {
+      s_shared = new Handler(s_handlers.size(), ~0u, 0);
+      if (!s_shared) {
+        printf("TRAC: out of memory for the handler of exited threads\n");
+        abort();
+      }
     }
+    handler = s_shared;
+  }
+  return handler;
+}
+
+void Handler::endAlloc(uintptr_t base, const Alloc & info, void * data) // called holding s_createGuard
+{
+  Handler * owner = ownerOf(info.owner);
+  if (info.size >= owner->m_threshold) {
+    owner->log(false, base, info.size);
+  }
+}
+
+void Handler::endRegion(uintptr_t base, const Region & region, void * data) // called holding s_createGuard
+{
+  if (region.traced) {
+    ownerOf(region.owner)->log(false, base, region.size);
   }
-  return nullptr;
 }
 
 void Handler::createMemkind()
@@ -81,6 +169,41 @@ void Handler::destroyMemkind()
   }
 }
 
+static size_t pages(size_t size)
+{
+  return (size + DirectMap::PageSize - 1) & ~(DirectMap::PageSize - 1);
+}
+
+static uint8_t shiftOf(size_t size)
+{
+  return size? 63 - __builtin_clzl(size) : 0;
+}
+
+void Handler::initPageSizes()
+{
+  s_pageShift = shiftOf(sysconf(_SC_PAGESIZE));
+  FILE * file = fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r");
+  if (file) {
+    size_t size = 0;
+    if (fscanf(file, "%lu", &size) == 1 && size) {
+      s_thpShift = shiftOf(size);
+    }
+    fclose(file);
+  }
+  file = fopen("/proc/meminfo", "r");
+  if (file) {
+    char line[128];
+    size_t size = 0;
+    while (fgets(line, sizeof(line), file)) {
+      if (sscanf(line, "Hugepagesize: %lu kB", &size) == 1 && size) {
+        s_hugetlbShift = shiftOf(size << 10);
+        break;
+      }
+    }
+    fclose(file);
+  }
+}
+
 memkind_t Handler::getMemkind()
 {
   pthread_once(&s_memkindCreate, createMemkind);
@@ -94,85 +217,136 @@ memkind_t Handler::getMemkind()
 }
 
 
-Handler::Handler(size_t id)
+Handler::Handler(size_t id, uint32_t owner, pid_t tid)
 : m_id(id)
-, m_allocs()
-, m_allocsGuard(PTHREAD_RWLOCK_INITIALIZER)
-, m_log(nullptr)
+, m_owner(owner)
+, m_trace(nullptr)
+, m_syncsLogged(0)
 , m_threshold(0)
+, m_mmapThreshold(0)
 , m_stacklevels(0)
 , m_stackoffset(3)
+, m_stackLow(0)
+, m_stackHigh(0)
 , m_stackbuf(nullptr)
+, m_decisions(nullptr)
+, m_sampleBytes(0)
+, m_sampleCountdown(0)
+, m_random(0)
+, m_weight(0)
+, m_pages(Policy::DefaultPages)
+, m_stats(Stats::create())
+, m_path(Stats::Untraced)
 {
   char * logpath = getenv("TRAC_LOGPATH");
   if (logpath) {
     char logfilename[256];
-    snprintf(logfilename, sizeof(logfilename), "%s/alloc_%ld_%d.log", logpath, id, gettid());
-    m_log = fopen(logfilename, "w");
+    snprintf(logfilename, sizeof(logfilename), "%s/alloc_%ld_%d.trc", logpath, id, tid);
+    m_trace = Trace::open(logfilename, id, tid);
+    logClock();
   }
   char * threshold = getenv("TRAC_THRESHOLD");
   if (threshold) {
     m_threshold = strtoul(threshold, nullptr, 0);
   }
+  char * mmapthreshold = getenv("TRAC_MMAP_THRESHOLD");
+  if (mmapthreshold) {
+    m_mmapThreshold = strtoul(mmapthreshold, nullptr, 0);
+  }
+  char * samplebytes = getenv("TRAC_SAMPLE_BYTES");
+  if (samplebytes) {
+    m_sampleBytes = strtoul(samplebytes, nullptr, 0);
+  }
+  if (m_sampleBytes) {
+    // sampling decides which allocations are traced instead of the threshold
+    m_threshold = 0;
+    m_random = ((uint64_t)gettid() << 32) ^ Clock::ns() ^ 0x9e3779b97f4a7c15ull;
+    m_sampleCountdown = nextSample();
+  }
   char * stacklevels = getenv("TRAC_STACKLEVELS");
   if (stacklevels) {
     m_stacklevels = strtoul(stacklevels, nullptr, 0);
   }
   if (m_stacklevels) {
-    m_stackbuf = new Mappings::LibAddr[m_stacklevels];
+    m_stackbuf = (uintptr_t *)Arena::allocate(m_stacklevels * sizeof(uintptr_t));
+    pthread_attr_t attr;
+    if (!pthread_getattr_np(pthread_self(), &attr)) {
+      void * addr = nullptr;
+      size_t size = 0;
+      pthread_attr_getstack(&attr, &addr, &size);
+      m_stackLow = (uintptr_t)addr;
+      m_stackHigh = m_stackLow + size;
+      pthread_attr_destroy(&attr);
+    }
+  }
+  if (Policy::get()) {
+    m_decisions = (Policy::Decision *)Arena::allocate(Policy::CacheSize * sizeof(Policy::Decision));
+    for (size_t idx = 0; idx < Policy::CacheSize; ++idx) {
+      m_decisions[idx] = Policy::Decision{0, ~0u, nullptr, Policy::DefaultPages};
+    }
   }
 }
 
 Handler::~Handler()
 {
   if (m_stackbuf) {
-    delete m_stackbuf;
+    Arena::deallocate(m_stackbuf, m_stacklevels * sizeof(uintptr_t));
     m_stackbuf = nullptr;
   }
+  if (m_decisions) {
+    Arena::deallocate(m_decisions, Policy::CacheSize * sizeof(Policy::Decision));
+    m_decisions = nullptr;
+  }
 }
 
 void * Handler::malloc(size_t size)
 {
-  void * ptr;
-  if (size < m_threshold) {
-    ptr = orig_malloc(size);
-    if (ptr) {
-      Alloc info = {size, nullptr};
-      this->allocInsert((uintptr_t)ptr, info);
-    }
-  } else {
-    size_t stackcnt = 0;
-    Mappings::LibAddr * stackbuf = stack(stackcnt);
-    memkind_t kind = select(size, stackbuf, stackcnt);
-    ptr = memkind_malloc(kind, size);
-    if (ptr) {
-      log(true, (uintptr_t)ptr, size, stackbuf, stackcnt);
-      Alloc info = {size, kind};
-      this->allocInsert((uintptr_t)ptr, info);
-    }
+  m_path = Stats::Untraced;
+  Stats::EntryTimer timer(m_stats, Stats::Malloc, m_path);
+  if (!traced(size)) {
+    return orig_malloc(size);
+  }
+  // captured here, so the stack starts at the caller like for the other entry points
+  return mallocTraced(size, stack());
+}
+
+void * Handler::mallocTraced(size_t size, uint32_t stackid)
+{
+  memkind_t kind = backing(size, select(size, stackid));
+  void * ptr = allocate(kind, size);
+  if (ptr && !Registry::insert((uintptr_t)ptr, Alloc{size, kind, m_owner, 0})) {
+    // a free could not find it, so glibc serves it instead
+    release(kind, ptr, size);
+    return orig_malloc(size);
+  }
+  if (ptr) {
+    logAlloc(ptr, size, stackid, kind);
   }
   return ptr;
 }
 
 void * Handler::calloc(size_t count, size_t unit)
 {
-  size_t size = count * unit;
+  size_t size;
+  if (__builtin_mul_overflow(count, unit, &size)) {
+    errno = ENOMEM;
+    return nullptr;
+  }
+  m_path = Stats::Untraced;
+  Stats::EntryTimer timer(m_stats, Stats::Calloc, m_path);
   void * ptr;
-  if (size < m_threshold) {
+  if (!traced(size)) {
     ptr = orig_calloc(count, unit);
-    if (ptr) {
-      Alloc info = {size, nullptr};
-      this->allocInsert((uintptr_t)ptr, info);
-    }
   } else {
-    size_t stackcnt = 0;
-    Mappings::LibAddr * stackbuf = stack(stackcnt);
-    memkind_t kind = select(size, stackbuf, stackcnt);
-    ptr = memkind_calloc(kind, count, unit);
+    uint32_t stackid = stack();
+    memkind_t kind = backing(size, select(size, stackid));
+    ptr = allocate(kind, size, 0, true);
+    if (ptr && !Registry::insert((uintptr_t)ptr, Alloc{size, kind, m_owner, 0})) {
+      release(kind, ptr, size);
+      return orig_calloc(count, unit);
+    }
     if (ptr) {
-      log(true, (uintptr_t)ptr, size, stackbuf, stackcnt);
-      Alloc info = {size, kind};
-      this->allocInsert((uintptr_t)ptr, info);
+      logAlloc(ptr, size, stackid, kind);
     }
   }
   return ptr;
@@ -180,243 +354,686 @@ void * Handler::calloc(size_t count, size_t unit)
 
 int    Handler::memalign(void ** pptr, size_t bound, size_t size)
 {
+  m_path = Stats::Untraced;
+  Stats::EntryTimer timer(m_stats, Stats::Memalign, m_path);
   int err;
-  if (size < m_threshold) {
+  if (!traced(size)) {
     err = orig_posix_memalign(pptr, bound, size);
-    if (!err) {
-      Alloc info = {size, nullptr};
-      this->allocInsert((uintptr_t)(*pptr), info);
-    }
   } else {
-    size_t stackcnt = 0;
-    Mappings::LibAddr * stackbuf = stack(stackcnt);
-    memkind_t kind = select(size, stackbuf, stackcnt);
-    err = memkind_posix_memalign(kind, pptr, bound, size);
+    if (!bound || bound % sizeof(void *) || (bound & (bound - 1))) {
+      return EINVAL;
+    }
+    uint32_t stackid = stack();
+    memkind_t kind = select(size, stackid);
+    if (bound <= DirectMap::PageSize) {
+      kind = backing(size, kind);
+    }
+    *pptr = allocate(kind, size, bound);
+    err = *pptr? 0 : ENOMEM;
+    if (!err && !Registry::insert((uintptr_t)(*pptr), Alloc{size, kind, m_owner, 0})) {
+      release(kind, *pptr, size);
+      return orig_posix_memalign(pptr, bound, size);
+    }
     if (!err) {
-      log(true, (uintptr_t)(*pptr), size, stackbuf, stackcnt);
-      Alloc info = {size, kind};
-      this->allocInsert((uintptr_t)(*pptr), info);
+      logAlloc(*pptr, size, stackid, kind);
     }
   }
   return err;
 }
 
-bool Handler::realloc(void ** pptr, size_t size)
+void * Handler::realloc(void * oldptr, size_t size)
 {
-  void * oldptr = *pptr;
+  m_path = Stats::Untraced;
+  Stats::EntryTimer timer(m_stats, Stats::Realloc, m_path);
   Alloc oldinfo;
-  Handler * home = allocLookup((uintptr_t)oldptr, oldinfo);
-  if (!home) {
-    return false;
+  // claim the entry up front, so the old address can not be reused and registered
+  //   by another thread before we are done with it
+  if (!Registry::owns((uintptr_t)oldptr) || !Registry::remove((uintptr_t)oldptr, oldinfo)) {
+    // untracked glibc allocation, it stays with glibc unless the new size is traced
+    if (!traced(size)) {
+      return orig_realloc(oldptr, size);
+    }
+    size_t oldsize = orig_malloc_usable_size(oldptr);
+    void * newptr = mallocTraced(size, stack());
+    if (newptr) {
+      memcpy(newptr, oldptr, (oldsize < size)? oldsize : size);
+      orig_free(oldptr);
+    }
+    return newptr;
+  }
+  if (Prefault::enabled(oldinfo.size)) {
+    Prefault::wait((uintptr_t)oldptr);
+  }
+  if (AccessSampler::active()) {
+    AccessSampler::release((uintptr_t)oldptr, oldinfo.size);
+  }
+  m_path = pathOf(oldinfo.kind);
+  if (!size) {
+    // frees like glibc, mremap and memkind_realloc would fail or free behind our back
+    release(oldinfo.kind, oldptr, oldinfo.size);
+    if (oldinfo.size >= m_threshold) {
+      uint32_t stackid = stack();
+      log(false, (uintptr_t)oldptr, oldinfo.size, stackid);
+    }
+    return nullptr;
   }
   void * newptr;
+  memkind_t newkind;
   if (size < m_threshold) {
-    if (oldinfo.kind) {
-      newptr = memkind_realloc(oldinfo.kind, oldptr, size);
-    } else {
-      newptr = orig_realloc(oldptr, size);
-    }
+    newkind = oldinfo.kind;
+    newptr = resize(oldinfo.kind, oldptr, oldinfo.size, size);
     if (newptr) {
       if (oldinfo.size >= m_threshold) {
-        size_t stackcnt = 0;
-        Mappings::LibAddr * stackbuf = stack(stackcnt);
-        log(false, (uintptr_t)oldptr, oldinfo.size, stackbuf, stackcnt);
+        uint32_t stackid = stack();
+        log(false, (uintptr_t)oldptr, oldinfo.size, stackid);
+      }
+      if (!Registry::insert((uintptr_t)newptr, Alloc{size, newkind, m_owner, oldinfo.tag})) {
+        newptr = untrace(newkind, newptr, size, size);
       }
-      Alloc newinfo = {size, oldinfo.kind};
-      home->allocRemove((uintptr_t)oldptr);
-      this->allocInsert((uintptr_t)newptr, newinfo);
     }
   } else {
-    size_t stackcnt = 0;
-    Mappings::LibAddr * stackbuf = stack(stackcnt);
-    memkind_t newkind = select(size, stackbuf, stackcnt);
+    // a sampled allocation stays traced when resized
+    m_weight = m_sampleBytes? sampleWeight(size) : 0;
+    uint32_t stackid = stack();
+    newkind = backing(size, select(size, stackid));
     if (oldinfo.kind == newkind) {
-      newptr = memkind_realloc(oldinfo.kind, oldptr, size);
+      newptr = resize(oldinfo.kind, oldptr, oldinfo.size, size);
     } else {
-      newptr = memkind_malloc(newkind, size);
+      newptr = allocate(newkind, size);
       if (newptr) {
         memcpy(newptr, oldptr, (oldinfo.size < size)? oldinfo.size : size);
-        if (oldinfo.kind) {
-          memkind_free(oldinfo.kind, oldptr);
-        } else {
-          orig_free(oldptr);
-        }
+        release(oldinfo.kind, oldptr, oldinfo.size);
       }
     }
     if (newptr) {
       if (oldinfo.size >= m_threshold) {
-        log(false, (uintptr_t)oldptr, oldinfo.size, stackbuf, stackcnt);
+        log(false, (uintptr_t)oldptr, oldinfo.size, stackid);
+      }
+      if (Registry::insert((uintptr_t)newptr, Alloc{size, newkind, m_owner, oldinfo.tag})) {
+        logAlloc(newptr, size, stackid, newkind);
+        if (oldinfo.tag) {
+          logTag((uintptr_t)newptr, size, oldinfo.tag);
+        }
+      } else {
+        newptr = untrace(newkind, newptr, size, size);
       }
-      log(true, (uintptr_t)newptr, size, stackbuf, stackcnt);
-      Alloc newinfo = {size, newkind};
-      home->allocRemove((uintptr_t)oldptr);
-      this->allocInsert((uintptr_t)newptr, newinfo);
     }
   }
-  *pptr = newptr;
-  return true;
+  if (!newptr && !Registry::insert((uintptr_t)oldptr, oldinfo)) {
+    // the old block can not stay traced either, it ends like a successful realloc
+    if (oldinfo.size >= m_threshold) {
+      uint32_t stackid = stack();
+      log(false, (uintptr_t)oldptr, oldinfo.size, stackid);
+    }
+    newptr = untrace(oldinfo.kind, oldptr, oldinfo.size, size);
+  }
+  return newptr;
 }
 
 bool   Handler::free(void * ptr)
 {
+  m_path = Stats::Untraced;
+  Stats::EntryTimer timer(m_stats, Stats::Free, m_path);
   Alloc info;
-  Handler * home = allocLookup((uintptr_t)ptr, info);
-  if (!home) {
+  if (!Registry::owns((uintptr_t)ptr) || !Registry::remove((uintptr_t)ptr, info)) {
     return false;
   }
+  m_path = pathOf(info.kind);
 
-  if (info.kind) {
-    memkind_free(info.kind, ptr);
-  } else {
-    orig_free(ptr);
+  if (Prefault::enabled(info.size)) {
+    Prefault::wait((uintptr_t)ptr);
+  }
+  if (AccessSampler::active()) {
+    AccessSampler::release((uintptr_t)ptr, info.size);
   }
+  release(info.kind, ptr, info.size);
   if (info.size >= m_threshold) {
-    size_t stackcnt = 0;
-    Mappings::LibAddr * stackbuf = stack(stackcnt);
-    log(false, (uintptr_t)ptr, info.size, stackbuf, stackcnt);
+    uint32_t stackid = stack();
+    log(false, (uintptr_t)ptr, info.size, stackid);
   }
-  home->allocRemove((uintptr_t)ptr);
   return true;
 }
 
 bool   Handler::getsize(void * ptr, size_t * size)
 {
-  uintptr_t base = (uintptr_t)ptr;
+  m_path = Stats::Untraced;
+  Stats::EntryTimer timer(m_stats, Stats::Getsize, m_path);
   Alloc info;
-  Handler * home = allocLookup(base, info);
-  if (!home) {
+  if (!Registry::owns((uintptr_t)ptr) || !Registry::lookup((uintptr_t)ptr, info)) {
     return false;
   }
+  m_path = pathOf(info.kind);
   *size = info.size;
   return true;
 }
 
+bool   Handler::tag(void * ptr, size_t size, const char * name)
+{
+  uint32_t tag = Tags::intern(name);
+  Alloc info;
+  bool known = Registry::owns((uintptr_t)ptr) && Registry::tag((uintptr_t)ptr, tag, info);
+  Region region;
+  if (!known && !MapRegistry::empty() && MapRegistry::tag((uintptr_t)ptr, tag, region)) {
+    known = true;
+    info.size = region.size;
+    info.tag = region.tag;
+  }
+  if (!size) {
+    if (!known) {
+      return false;
+    }
+    if (info.tag == tag) {
+      return true; // renaming to the same name is not traced again
+    }
+    size = info.size;
+  }
+  logTag((uintptr_t)ptr, size, tag);
+  return true;
+}
+
+void * Handler::mmap(void * addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+  m_path = Stats::Untraced;
+  Stats::EntryTimer timer(m_stats, Stats::Mmap, m_path);
+  void * ptr = orig_mmap(addr, length, prot, flags, fd, offset);
+  if (ptr == MAP_FAILED) {
+    return ptr;
+  }
+  Region region{};
+  region.size = pages(length);
+  region.owner = m_owner;
+  region.flags = ((flags & MAP_ANONYMOUS)? 0 : MapFile) | (((flags & MAP_TYPE) != MAP_PRIVATE)? MapShared : 0);
+  region.offset = (flags & MAP_ANONYMOUS)? 0 : offset;
+  // captured here, so the stack starts at the caller like for mremap
+  uint32_t stackid = stack();
+  // with MAP_FIXED, the mapping replaces whatever was there
+  unmapped((uintptr_t)ptr, (uintptr_t)ptr + region.size, stackid);
+  if (traced(region.size)) {
+    region.traced = true;
+    region.stack = stackid;
+    if (region.flags & MapFile) {
+      region.file = fileOf(fd);
+    }
+    mapped((uintptr_t)ptr, region);
+  }
+  MapRegistry::insert((uintptr_t)ptr, region);
+  return ptr;
+}
+
+int    Handler::munmap(void * addr, size_t length)
+{
+  m_path = Stats::Untraced;
+  Stats::EntryTimer timer(m_stats, Stats::Munmap, m_path);
+  // regions are released before the pages, so no other thread can map and record them meanwhile,
+  //   calls failing with EINVAL are passed on only
+  if (length && !((uintptr_t)addr % DirectMap::PageSize) && !MapRegistry::empty()) {
+    unmapped((uintptr_t)addr, (uintptr_t)addr + pages(length), stack());
+  }
+  return orig_munmap(addr, length);
+}
+
+void * Handler::mremap(void * addr, size_t oldsize, size_t size, int flags, void * newaddr)
+{
+  m_path = Stats::Untraced;
+  Stats::EntryTimer timer(m_stats, Stats::Mremap, m_path);
+  uintptr_t begin = (uintptr_t)addr;
+  uintptr_t end = begin + pages(oldsize);
+  uintptr_t base;
+  Region region;
+  // claim the region up front like realloc, an old size of 0 duplicates a shared mapping instead
+  bool known = oldsize && MapRegistry::take(begin, begin + 1, base, region);
+  void * res = orig_mremap(addr, oldsize, size, flags, newaddr);
+  if (res == MAP_FAILED) {
+    if (known) {
+      MapRegistry::insert(base, region);
+    }
+    return res;
+  }
+  if (!known) {
+    // with MREMAP_FIXED, the mapping replaces whatever was there
+    if (!MapRegistry::empty()) {
+      unmapped((uintptr_t)res, (uintptr_t)res + pages(size), stack());
+    }
+    return res;
+  }
+  uint32_t stackid = stack();
+  if (region.traced) {
+    m_path = Stats::Mapped;
+    log(false, base, region.size, stackid);
+  }
+  // parts of the region outside the remapped range stay where they are
+  if (base < begin) {
+    keep(base, begin - base, region, 0);
+  }
+  if (end < base + region.size) {
+    keep(end, base + region.size - end, region, end - base);
+  }
+  Region moved = region;
+  moved.size = pages(size);
+  moved.owner = m_owner;
+  if (moved.flags & MapFile) {
+    moved.offset += begin - base;
+  }
+  unmapped((uintptr_t)res, (uintptr_t)res + moved.size, stackid);
+  if (region.traced && m_sampleBytes) {
+    // a sampled region stays traced when resized
+    m_weight = sampleWeight(moved.size);
+  } else {
+    moved.traced = traced(moved.size);
+  }
+  if (moved.traced) {
+    moved.stack = stackid;
+    m_path = Stats::Mapped;
+    log(true, (uintptr_t)res, moved.size, stackid, m_weight, Placement{moved.pages, false, 0, 0}, &moved);
+    if (moved.tag) {
+      logTag((uintptr_t)res, moved.size, moved.tag);
+    }
+  }
+  MapRegistry::insert((uintptr_t)res, moved);
+  return res;
+}
+
+int    Handler::brk(void * addr)
+{
+  m_path = Stats::Untraced;
+  Stats::EntryTimer timer(m_stats, Stats::Brk, m_path);
+  void * old = orig_sbrk(0);
+  int res = orig_brk(addr);
+  if (!res && old != (void *)-1) {
+    breakMoved((uintptr_t)old, (uintptr_t)addr, stack());
+  }
+  return res;
+}
+
+void * Handler::sbrk(intptr_t increment)
+{
+  m_path = Stats::Untraced;
+  Stats::EntryTimer timer(m_stats, Stats::Brk, m_path);
+  void * old = orig_sbrk(increment);
+  if (old != (void *)-1 && increment) {
+    breakMoved((uintptr_t)old, (uintptr_t)old + increment, stack());
+  }
+  return old;
+}
+
 void Handler::onEnd()
 {
-  // printf("!!%d:onEnd():WRlock(%p)\n", gettid(), &m_allocsGuard);
-  pthread_rwlock_wrlock(&m_allocsGuard);
-  for (auto & entry : m_allocs) {
-    if (entry.second.size > m_threshold) {
-      log(false, entry.first, entry.second.size);
+  if (m_trace) {
+    Prefault::Result result;
+    while (Prefault::collect(m_owner, result, true)) {
+      logPrefault(result);
+    }
+    logClock();
+    m_trace->close();
+    if (m_stats) {
+      m_stats->traceBytes += m_trace->written();
+      m_stats->traceDropped += m_trace->dropped();
+    }
+    delete m_trace;
+    m_trace = nullptr;
+  }
+}
+
+uint32_t Handler::fileOf(int fd)
+{
+  char link[32];
+  char path[256];
+  snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+  ssize_t len = readlink(link, path, sizeof(path) - 1);
+  if (len <= 0) {
+    return 0;
+  }
+  path[len] = '\0';
+  return Tags::intern(path);
+}
+
+void Handler::mapped(uintptr_t base, Region & region)
+{
+  m_path = Stats::Mapped;
+  Placement placement{};
+  if (MapRegistry::mode() == MapRegistry::Place && !(region.flags & (MapFile | MapShared))) {
+    // the program owns the pages, so only pages and nodes of a Policy apply, not its memkind
+    m_pages = Policy::DefaultPages;
+    if (Policy::get()) {
+      select(region.size, region.stack);
+      if (m_pages == Policy::HugetlbPages) {
+        m_pages = Policy::DefaultPages; // hugetlbfs can not back pages mapped already
+      }
     }
+    placement = place((void *)base, region.size, MEMKIND_DEFAULT);
+  }
+  region.pages = placement.flags;
+  log(true, base, region.size, region.stack, m_weight, placement, &region);
+}
+
+void Handler::unmapped(uintptr_t begin, uintptr_t end, uint32_t stackid)
+{
+  if (MapRegistry::empty()) {
+    return;
   }
-  m_allocs.clear();
-  pthread_rwlock_unlock(&m_allocsGuard);
-  // printf("!!%d:onEnd():WRfree(%p)\n", gettid(), &m_allocsGuard);
-  if (m_log) {
-    fclose(m_log);
+  uintptr_t base;
+  Region region;
+  while (MapRegistry::take(begin, end, base, region)) {
+    if (region.traced) {
+      m_path = Stats::Mapped;
+      log(false, base, region.size, stackid);
+    }
+    // parts of the region outside the range stay mapped
+    if (base < begin) {
+      keep(base, begin - base, region, 0);
+    }
+    if (end < base + region.size) {
+      keep(end, base + region.size - end, region, end - base);
+    }
   }
 }
 
-Handler * Handler::allocLookup(uintptr_t base, Alloc & info)
+void Handler::keep(uintptr_t base, size_t size, Region region, size_t skip)
 {
-  if (localAllocLookup(base, info)) {
-    return this;
+  region.size = size;
+  if (region.flags & MapFile) {
+    region.offset += skip;
+  }
+  if (region.traced) {
+    m_weight = m_sampleBytes? sampleWeight(size) : 0;
+    log(true, base, size, region.stack, m_weight, Placement{region.pages, false, 0, 0}, &region);
+    if (region.tag) {
+      logTag(base, size, region.tag);
+    }
+  }
+  MapRegistry::insert(base, region);
+}
+
+void Handler::breakMoved(uintptr_t from, uintptr_t to, uint32_t stackid)
+{
+  if (to < from) {
+    unmapped(to, from, stackid);
+    return;
+  }
+  if (to == from || !Roi::traced()) {
+    return;
+  }
+  Region region{};
+  region.size = to - from;
+  region.owner = m_owner;
+  region.flags = MapBreak;
+  if (traced(region.size)) {
+    region.traced = true;
+    region.stack = stackid;
+    mapped(from, region);
+  }
+  MapRegistry::insert(from, region);
+}
+
+memkind_t Handler::backing(size_t size, memkind_t kind) const
+{
+  if (!m_mmapThreshold || size < m_mmapThreshold) {
+    return kind;
+  }
+  if (kind == MEMKIND_DEFAULT) {
+    return DirectMap::anonymous();
+  }
+  if (kind == s_memkind) {
+    return DirectMap::file(); // in TRAC_PMEMDIR
+  }
+  return kind; // other file backed kinds of a Policy stay with memkind
+}
+
+void * Handler::allocate(memkind_t & kind, size_t size, size_t bound, bool zero)
+{
+  void * ptr;
+  if (DirectMap::owns(kind)) {
+    ptr = DirectMap::map(kind, size); // fresh pages are zero already
+  } else if (bound) {
+    if (memkind_posix_memalign(kind, &ptr, bound, size)) {
+      ptr = nullptr;
+    }
+  } else if (zero) {
+    ptr = memkind_calloc(kind, 1, size);
+  } else {
+    ptr = memkind_malloc(kind, size);
+  }
+  if (!ptr && kind == MEMKIND_HUGETLB) {
+    // no huge pages (left) in the pool, fall back to base pages
+    kind = MEMKIND_DEFAULT;
+    m_pages = Policy::DefaultPages;
+    return allocate(kind, size, bound, zero);
+  }
+  return ptr;
+}
+
+uint8_t Handler::applyPages(void * ptr, size_t size) const
+{
+  pthread_once(&s_pageSizesInit, initPageSizes);
+  switch (m_pages) {
+  case Policy::TransparentHugePages:
+  case Policy::SmallPages: {
+    // advice can only cover the pages lying entirely within the allocation
+    size_t page = 1ul << s_pageShift;
+    uintptr_t begin = ((uintptr_t)ptr + page - 1) & ~(page - 1);
+    uintptr_t end = ((uintptr_t)ptr + size) & ~(page - 1);
+    bool huge = m_pages == Policy::TransparentHugePages;
+    if (begin < end) {
+      madvise((void *)begin, end - begin, huge? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+    }
+    return huge? (TransparentPages | s_thpShift) : s_pageShift;
+  }
+  case Policy::HugetlbPages:
+    return s_hugetlbShift;
+  default:
+    return 0;
   }
-  return globalAllocLookup(base, info, this);
 }
 
-memkind_t Handler::select(size_t size, Mappings::LibAddr * stackbuf, size_t stackcnt)
+Handler::Placement Handler::place(void * ptr, size_t size, memkind_t kind) const
 {
-  memkind_t kind = getMemkind();
+  Placement placement{};
+  placement.flags = applyPages(ptr, size);
+  // hugetlb and file backed pages are left to their kinds
+  if ((kind == MEMKIND_DEFAULT || kind == DirectMap::anonymous()) && Numa::mode() != Numa::NoPlacement) {
+    placement.cpuNode = Numa::currentNode();
+    placement.placed = Numa::place(ptr, size, placement.cpuNode, placement.node);
+  }
+  return placement;
+}
+
+void * Handler::resize(memkind_t kind, void * ptr, size_t oldsize, size_t size)
+{
+  if (DirectMap::owns(kind)) {
+    return DirectMap::remap(kind, ptr, oldsize, size);
+  } else if (kind) {
+    return memkind_realloc(kind, ptr, size);
+  } else {
+    return orig_realloc(ptr, size);
+  }
+}
+
+void Handler::release(memkind_t kind, void * ptr, size_t size)
+{
+  if (DirectMap::owns(kind)) {
+    DirectMap::unmap(kind, ptr, size);
+  } else if (kind) {
+    memkind_free(kind, ptr);
+  } else {
+    orig_free(ptr);
+  }
+}
+
+void * Handler::untrace(memkind_t kind, void * ptr, size_t oldsize, size_t size)
+{
+  m_path = Stats::Untraced;
+  void * copy = orig_malloc(size);
+  if (!copy) {
+    // the caller's data lives only in ptr, which nothing could free later
+    printf("TRAC: out of memory for the untraced copy of %p\n", ptr);
+    abort();
+  }
+  memcpy(copy, ptr, (oldsize < size)? oldsize : size);
+  release(kind, ptr, oldsize);
+  return copy;
+}
+
+Stats::Path Handler::pathOf(memkind_t kind)
+{
+  if (DirectMap::owns(kind)) {
+    return Stats::Mapped;
+  }
+  if (kind == MEMKIND_DEFAULT || kind == MEMKIND_HUGETLB) {
+    return Stats::Dram;
+  }
+  return Stats::Pmem;
+}
+
+bool Handler::traced(size_t size)
+{
+  if (!m_sampleBytes) {
+    m_weight = 0;
+    return size >= m_threshold;
+  }
+  // a countdown of bytes drawn from an exponential distribution samples each
+  //   allocation with probability 1 - exp(-size / TRAC_SAMPLE_BYTES)
+  m_sampleCountdown -= size;
+  if (m_sampleCountdown >= 0) {
+    return false;
+  }
+  m_sampleCountdown = nextSample();
+  m_weight = sampleWeight(size);
+  return true;
+}
+
+int64_t Handler::nextSample()
+{
+  // xorshift64*, top 53 bits as uniform value in (0, 1]
+  m_random ^= m_random >> 12;
+  m_random ^= m_random << 25;
+  m_random ^= m_random >> 27;
+  double uniform = ((m_random * 0x2545f4914f6cdd1dull >> 11) + 1) * (1.0 / (1ull << 53));
+  return (int64_t)(-::log(uniform) * m_sampleBytes) + 1;
+}
+
+uint64_t Handler::sampleWeight(size_t size) const
+{
+  // size divided by the sampling probability gives an unbiased estimate of the bytes allocated
+  double probability = -expm1(-(double)size / m_sampleBytes);
+  return (uint64_t)(size / probability + 0.5);
+}
+
+memkind_t Handler::select(size_t size, uint32_t stack)
+{
+  const Policy * policy = Policy::get();
+  m_pages = Policy::DefaultPages;
+  if (!policy) {
+    return getMemkind(); // uses a shared memkind across all threads
+  }
+  // rules are evaluated once per call site and size band of this thread
+  uint32_t band = policy->band(size);
+  Policy::Decision & decision = m_decisions[((stack * 0x9e3779b1u) ^ band) & (Policy::CacheSize - 1)];
+  if (decision.stack != stack || decision.band != band) {
+    decision.stack = stack;
+    decision.band = band;
+    policy->evaluate(size, stack, m_id, decision.kind, decision.pages);
+  }
+  memkind_t kind = decision.kind? decision.kind : getMemkind();
+  m_pages = decision.pages;
+  if (m_pages == Policy::HugetlbPages) {
+    // hugetlbfs backing is only available in place of plain dram
+    if (kind == MEMKIND_DEFAULT) {
+      kind = MEMKIND_HUGETLB;
+    } else {
+      m_pages = Policy::DefaultPages;
+    }
+  }
   // printf("Handler::select(%ld, ...) = %p\n", size, kind);
   return kind;
-  // return getMemkind(); // uses a shared memkind across all threads
 }
 
-bool Handler::localAllocLookup(uintptr_t base, Alloc & info)
+
+__attribute__((noinline))
+uint32_t Handler::stack()
 {
-  bool success = false;
-  // printf("!!%d:localAllocLookup():RDlock(%p)\n", gettid(), &m_allocsGuard);
-  pthread_rwlock_rdlock(&m_allocsGuard);
-  auto it = m_allocs.find(base);
-  if (it != m_allocs.end()) {
-    info = it->second;
-    success = true;
+  if (!m_stackbuf) {
+    return 0;
   }
-  pthread_rwlock_unlock(&m_allocsGuard);
-  // printf("!!%d:localAllocLookup():RDfree(%p)\n", gettid(), &m_allocsGuard);
-  return success;
+  Stats::Timer timer(m_stats? &m_stats->sections[Stats::StackSection] : nullptr);
+  size_t count = Stacks::capture(m_stackbuf, m_stacklevels, m_stackoffset, m_stackLow, m_stackHigh);
+  return Stacks::intern(m_stackbuf, count);
 }
 
-void Handler::allocInsert(uintptr_t base, const Alloc & info)
+void Handler::logClock()
 {
-  // printf("!!%d:allocInsert():WRlock(%p)\n", gettid(), &m_allocsGuard);
-  pthread_rwlock_wrlock(&m_allocsGuard);
-  m_allocs.emplace(base, info);
-  pthread_rwlock_unlock(&m_allocsGuard);
-  // printf("!!%d:allocInsert():WRfree(%p)\n", gettid(), &m_allocsGuard);
+  if (!m_trace || !Clock::usesTicks()) {
+    return;
+  }
+  size_t count = 0;
+  const Clock::Sync * syncs = Clock::syncs(count);
+  for (; m_syncsLogged < count; ++m_syncsLogged) {
+    const Clock::Sync & sync = syncs[m_syncsLogged];
+    m_trace->put(Record{ClockInfo, 0, 0, sync.ticks, sync.ns, 0});
+  }
 }
 
-void Handler::allocRemove(uintptr_t base)
+void Handler::logAlloc(void * ptr, size_t size, uint32_t stack, memkind_t kind)
 {
-  // printf("!!%d:allocRemove():WRlock(%p)\n", gettid(), &m_allocsGuard);
-  pthread_rwlock_wrlock(&m_allocsGuard);
-  m_allocs.erase(base);
-  pthread_rwlock_unlock(&m_allocsGuard);
-  // printf("!!%d:allocRemove():WRfree(%p)\n", gettid(), &m_allocsGuard);
+  m_path = pathOf(kind);
+  Placement placement = place(ptr, size, kind);
+  log(true, (uintptr_t)ptr, size, stack, m_weight, placement);
+  if (Prefault::enabled(size)) {
+    // helpers go where first touch by this thread would have put the pages
+    int node = placement.placed? placement.node : Numa::currentNode();
+    Prefault::Result result;
+    if (Prefault::submit(ptr, size, node, m_owner, m_trace != nullptr, result)) {
+      logPrefault(result);
+    }
+  }
 }
 
+void Handler::logPrefault(const Prefault::Result & result)
+{
+  if (!m_trace) {
+    return;
+  }
+  m_trace->put(Record{PrefaultInfo, result.share, (uint32_t)result.node, result.time, result.base, result.ns});
+}
 
-Mappings::LibAddr * Handler::stack(size_t & count)
+void Handler::logTag(uintptr_t base, size_t size, uint32_t tag)
 {
-  if (!m_stackbuf) {
-    return nullptr;
+  if (!m_trace) {
+    return;
   }
-  size_t capacity = m_stacklevels + m_stackoffset;
-  void ** buffer = (void **)alloca(capacity * sizeof(void *));
-  size_t levels = backtrace(buffer, capacity);
-  count = 0;
-  for (size_t idx = m_stackoffset; idx < levels; ++idx) {
-    Mappings::lookup((uintptr_t)buffer[idx], m_stackbuf[count++]);
-  }
-  return m_stackbuf;
-}
-
-// size_t Handler::stack(uintptr_t * buf, size_t count, size_t offset)
-// {
-//   unw_cursor_t cursor;
-//   unw_context_t context;
-//   unw_word_t ip = 0;
-
-//   if (unw_getcontext(&context) < 0) {
-//     return 0;
-//   }
-//   if (unw_init_local(&cursor, &context) < 0) {
-//     return 0;
-//   }
-//   size_t pos = 0;
-//   for (size_t idx = 0; idx < count + offset; ++idx) {
-//     if (idx >= offset) {
-//       unw_get_reg(&cursor, UNW_REG_IP, &ip);
-//       buf[pos++] = ip;
-//       //unw_word_t off;
-//       //char buf[256];
-//       //unw_get_proc_name(&cursor, buf, sizeof(buf), &off);
-//       //printf("..%s + %lx\n", buf, off);
-//     }
-//     if (unw_step(&cursor) <= 0) {
-//       break;
-//     }
-//   }
-//   return pos;
-// }
-
-// void Handler::log(size_t free, size_t alloc, size_t size)
-void Handler::log(bool alloc, uintptr_t base, size_t size, Mappings::LibAddr * sbuf, size_t snum)
-{
-  if (!m_log) {
+  m_trace->put(Record{TagInfo, 0, tag, Clock::now(), base, size});
+}
+
+void Handler::log(bool alloc, uintptr_t base, size_t size, uint32_t stack, uint64_t weight, const Placement & placement,
+                  const Region * region)
+{
+  if (!m_trace) {
     return;
   }
-  struct timespec now;
-  clock_gettime(CLOCK_MONOTONIC_RAW, &now);
-  fprintf(m_log, "%c%ld.%09ld,%016lx,%016lx", alloc? '+' : '-', now.tv_sec, now.tv_nsec, base, size);
-  if (sbuf) {
-    for (size_t i = 0; i < snum; ++i) {
-      fprintf(m_log, ",%ld+%lx", sbuf[i].index, sbuf[i].offset);
+  Stats::Timer timer(m_stats? &m_stats->sections[Stats::LogSection] : nullptr);
+  Record rec;
+  rec.type = alloc? AllocEvent : FreeEvent;
+  rec.flags = placement.flags;
+  rec.stack = stack;
+  rec.time = Clock::now();
+  rec.base = base;
+  rec.size = size;
+  m_trace->put(rec);
+  if (weight) {
+    m_trace->put(Record{WeightInfo, 0, 0, 0, 0, weight});
+  }
+  if (placement.placed) {
+    uint8_t flags = (placement.node < 0)? NodeInterleaved : 0;
+    m_trace->put(Record{NodeInfo, flags, 0, 0, (uint64_t)placement.cpuNode, (uint64_t)(placement.node < 0? 0 : placement.node)});
+  }
+  if (region) {
+    m_trace->put(Record{MapInfo, region->flags, region->file, 0, region->offset, 0});
+  }
+  if (Prefault::async()) {
+    Prefault::Result result;
+    while (Prefault::collect(m_owner, result)) {
+      logPrefault(result);
     }
   }
-  fprintf(m_log, "\n");
 }
 
 
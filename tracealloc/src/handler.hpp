@@ -1,6 +1,5 @@
 #pragma once
 
-#include <map>
 #include <vector>
 #include <utility>
 
@@ -9,71 +8,151 @@
 
 #include <memkind.h>
 
+#include "arena.hpp"
 #include "common.hpp"
+#include "directmap.hpp"
+#include "mapregistry.hpp"
 #include "mappings.hpp"
+#include "numa.hpp"
+#include "policy.hpp"
+#include "prefault.hpp"
+#include "registry.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
 
 
 namespace trac
 {
 
-class Handler
+// Per-thread tracing state. Handlers of exited threads are retired and their
+//   slot (the id in alloc_<id>_<tid>.trc) is reused. Registry owners combine
+//   slot and incarnation of the slot, so allocations left behind by a retired
+//   handler are attributed to a shared owner at TRAC_END without any scan.
+//   A slot whose incarnations are used up is not reused, so owners never wrap.
+class Handler : public ArenaObject
 {
 public:
-  struct Alloc
+  using Alloc = Registry::Alloc;
+  using Region = MapRegistry::Region;
+
+  // backing of a traced allocation as logged with its event, zero if not controlled
+  struct Placement
   {
-    size_t size;
-    memkind_t kind;
+    uint8_t flags; // page size, see AllocEvent flags
+    bool placed;   // bound by TRAC_NUMA
+    int node;      // -1 if interleaved
+    int cpuNode;
   };
 
+  static constexpr uint32_t SlotBits = 20;
+  static constexpr uint32_t SlotMask = (1u << SlotBits) - 1;
+  static constexpr uint32_t MaxIncarnation = (1u << (32 - SlotBits)) - 1;
+
 private:
   static memkind_t s_memkind;
   static pthread_once_t s_memkindCreate;
   static pthread_once_t s_memkindDestroy;
 
-  static std::vector<Handler *> s_handlers;
+  static uint8_t s_pageShift;
+  static uint8_t s_thpShift;
+  static uint8_t s_hugetlbShift;
+  static pthread_once_t s_pageSizesInit;
+
+  static ArenaVector<Handler *> s_handlers;    // by slot, nullptr if free
+  static ArenaVector<uint32_t> s_incarnations;
+  static ArenaVector<size_t> s_freeSlots;
+  static Handler * s_shared;
+  static bool s_ended;
   static pthread_mutex_t s_createGuard;
 
   size_t m_id;
-  std::map<uintptr_t, Alloc> m_allocs;
-  pthread_rwlock_t m_allocsGuard;
-  FILE * m_log;
+  uint32_t m_owner;
+  Trace * m_trace;
+  size_t m_syncsLogged;
   size_t m_threshold;
+  size_t m_mmapThreshold;
   size_t m_stacklevels;
   size_t m_stackoffset;
-  Mappings::LibAddr * m_stackbuf;
-
-  Handler(size_t id);
+  uintptr_t m_stackLow;
+  uintptr_t m_stackHigh;
+  uintptr_t * m_stackbuf;
+  Policy::Decision * m_decisions;
+  size_t m_sampleBytes;
+  int64_t m_sampleCountdown;
+  uint64_t m_random;
+  uint64_t m_weight;
+  Policy::PageMode m_pages;
+  Stats::Local * m_stats; // nullptr without TRAC_STATS
+  uint8_t m_path;         // Stats::Path of the current entry point
+
+  Handler(size_t id, uint32_t owner, pid_t tid);
 
   static void createMemkind();
   static void destroyMemkind();
   static memkind_t getMemkind();
+  static void initPageSizes();
 
 public:
   static Handler * get();
+  // called when the handler's thread exits
+  static void retire(Handler * handler);
   static void end();
-  static Handler * globalAllocLookup(uintptr_t base, Alloc & info, Handler * exclude = nullptr);
 
   ~Handler();
 
   void * malloc(size_t size);
   void * calloc(size_t count, size_t unit);
   int    memalign(void ** pptr, size_t bound, size_t size);
-  bool   realloc(void ** ptr, size_t size);
+  void * realloc(void * ptr, size_t size);
   bool   free(void * ptr);
   bool   getsize(void * ptr, size_t * size);
+  // size 0 names the whole allocation at ptr, otherwise any range
+  bool   tag(void * ptr, size_t size, const char * name);
+
+  // regions mapped by the program itself (TRAC_MAPS)
+  void * mmap(void * addr, size_t length, int prot, int flags, int fd, off_t offset);
+  int    munmap(void * addr, size_t length);
+  void * mremap(void * addr, size_t oldsize, size_t size, int flags, void * newaddr);
+  int    brk(void * addr);
+  void * sbrk(intptr_t increment);
 
   void onEnd();
 
 private:
-  memkind_t select(size_t size, Mappings::LibAddr * stackbuf, size_t stacknum);
-
-  Handler * allocLookup(uintptr_t base, Alloc & info);
-  bool localAllocLookup(uintptr_t base, Alloc & info);
-  void allocInsert(uintptr_t base, const Alloc & info);
-  void allocRemove(uintptr_t base);
-
-  Mappings::LibAddr * stack(size_t & count);
-  void log(bool alloc, uintptr_t base, size_t size, Mappings::LibAddr * sbuf = nullptr, size_t snum = 0);
+  bool traced(size_t size);
+  int64_t nextSample();
+  uint64_t sampleWeight(size_t size) const;
+  void * mallocTraced(size_t size, uint32_t stackid);
+  memkind_t backing(size_t size, memkind_t kind) const;
+  void * allocate(memkind_t & kind, size_t size, size_t bound = 0, bool zero = false);
+  uint8_t applyPages(void * ptr, size_t size) const;
+  Placement place(void * ptr, size_t size, memkind_t kind) const;
+  static void * resize(memkind_t kind, void * ptr, size_t oldsize, size_t size);
+  static void release(memkind_t kind, void * ptr, size_t size);
+  // moves an allocation the Registry can not take over to glibc
+  void * untrace(memkind_t kind, void * ptr, size_t oldsize, size_t size);
+  static Stats::Path pathOf(memkind_t kind);
+  memkind_t select(size_t size, uint32_t stack);
+
+  static Handler * ownerOf(uint32_t owner);
+  static void endAlloc(uintptr_t base, const Alloc & info, void * data);
+  static void endRegion(uintptr_t base, const Region & region, void * data);
+
+  uint32_t fileOf(int fd);
+  void mapped(uintptr_t base, Region & region);
+  // stackid is captured by the entry point, so it starts at the caller
+  void unmapped(uintptr_t begin, uintptr_t end, uint32_t stackid);
+  // logs the part of a cut region that stays mapped with the region's own stack
+  void keep(uintptr_t base, size_t size, Region region, size_t skip);
+  void breakMoved(uintptr_t from, uintptr_t to, uint32_t stackid);
+
+  uint32_t stack();
+  void logClock();
+  void logAlloc(void * ptr, size_t size, uint32_t stack, memkind_t kind);
+  void logPrefault(const Prefault::Result & result);
+  void logTag(uintptr_t base, size_t size, uint32_t tag);
+  void log(bool alloc, uintptr_t base, size_t size, uint32_t stack = 0, uint64_t weight = 0, const Placement & placement = Placement{},
+           const Region * region = nullptr);
 };
 
 } // namespace trac
@@ -0,0 +1,112 @@
+#include "heatmap.hpp"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <new>
+
+
+namespace trac
+{
+
+pthread_once_t Heatmap::s_init = PTHREAD_ONCE_INIT;
+bool Heatmap::s_active = false;
+uint64_t Heatmap::s_span = 0;
+uintptr_t Heatmap::s_blockMask = ~(uintptr_t)4095;
+uint64_t Heatmap::s_dumpPeriod = 0;
+uint64_t Heatmap::s_lastDump = 0;
+int Heatmap::s_log = -1;
+Heatmap::Cells * Heatmap::s_cells = nullptr;
+
+void Heatmap::init()
+{
+  const char * span = getenv("TRAC_HEATMAP");
+  const char * logpath = getenv("TRAC_LOGPATH");
+  if (!span || !logpath || !strtoul(span, nullptr, 0)) {
+    return;
+  }
+  s_span = strtoul(span, nullptr, 0) * 1000000ull;
+  const char * block = getenv("TRAC_HEATMAP_BLOCK");
+  if (block) {
+    size_t size = strtoul(block, nullptr, 0);
+    if (size && !(size & (size - 1))) {
+      s_blockMask = ~(uintptr_t)(size - 1);
+    } else {
+      printf("TRAC_HEATMAP_BLOCK=%s is no power of two, using 4096\n", block);
+    }
+  }
+  const char * dump = getenv("TRAC_HEATMAP_DUMP");
+  if (dump) {
+    s_dumpPeriod = strtoul(dump, nullptr, 0) * 1000000000ull;
+  }
+  char logfilename[256];
+  snprintf(logfilename, sizeof(logfilename), "%s/heatmap.log", logpath);
+  s_log = open(logfilename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  if (s_log < 0) {
+    printf("TRAC_HEATMAP: can not open %s\n", logfilename);
+    return;
+  }
+  s_cells = new (Arena::allocate(sizeof(Cells))) Cells();
+  s_active = true;
+}
+
+void Heatmap::begin()
+{
+  pthread_once(&s_init, init);
+}
+
+void Heatmap::end()
+{
+  if (!s_active) {
+    return;
+  }
+  dump();
+  s_active = false;
+  close(s_log);
+}
+
+void Heatmap::add(uint64_t ns, uintptr_t addr, uintptr_t base, uint8_t kind)
+{
+  if (s_dumpPeriod && ns - s_lastDump >= s_dumpPeriod) {
+    if (s_lastDump) {
+      dump();
+    }
+    s_lastDump = ns;
+  }
+  Counts & counts = (*s_cells)[Key{ns - ns % s_span, base, addr & s_blockMask}];
+  switch (kind) {
+  case 1:
+    ++counts.reads;
+    break;
+  case 2:
+    ++counts.writes;
+    break;
+  default:
+    ++counts.unknown;
+    break;
+  }
+}
+
+void Heatmap::dump()
+{
+  // buckets still filling continue in the next dump, the ingest sums them up
+  char buffer[1 << 14];
+  size_t fill = 0;
+  for (const auto & cell : *s_cells) {
+    const Key & key = cell.first;
+    const Counts & counts = cell.second;
+    fill += snprintf(buffer + fill, sizeof(buffer) - fill, "%lu.%09lu,%lx,%lx,%lu,%lu,%lu\n",
+                     key.span / 1000000000ul, key.span % 1000000000ul, key.base, key.block,
+                     counts.reads, counts.writes, counts.unknown);
+    if (sizeof(buffer) - fill < 128) {
+      write(s_log, buffer, fill);
+      fill = 0;
+    }
+  }
+  write(s_log, buffer, fill);
+  s_cells->clear();
+}
+
+} // namespace trac
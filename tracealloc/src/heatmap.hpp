@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "arena.hpp"
+
+
+namespace trac
+{
+
+// In-process aggregation of software access samples (TRAC_ACCESS_RATE) into
+//   a heatmap, instead of writing each sample to access.log.
+// TRAC_HEATMAP sets the time bucket in milliseconds, TRAC_HEATMAP_BLOCK the
+//   block size in bytes (a power of two, default 4096). Counters are written
+//   to heatmap.log at TRAC_END and, with TRAC_HEATMAP_DUMP, every that many
+//   seconds, one line per bucket, allocation and block:
+//   <sec.nsec>,<allocation>,<block>,<reads>,<writes>,<unknown>
+class Heatmap
+{
+  struct Key
+  {
+    uint64_t span;
+    uintptr_t base;
+    uintptr_t block;
+
+    bool operator<(const Key & other) const
+    {
+      if (span != other.span) {
+        return span < other.span;
+      }
+      if (base != other.base) {
+        return base < other.base;
+      }
+      return block < other.block;
+    }
+  };
+
+  struct Counts
+  {
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t unknown; // read or write can not be told apart
+  };
+
+  typedef ArenaMap<Key, Counts> Cells;
+
+  static pthread_once_t s_init;
+  static bool s_active;
+  static uint64_t s_span;       // in ns
+  static uintptr_t s_blockMask;
+  static uint64_t s_dumpPeriod; // in ns, 0 for only at TRAC_END
+  static uint64_t s_lastDump;
+  static int s_log;
+  static Cells * s_cells;
+
+  static void init();
+  static void dump();
+
+public:
+  static void begin();
+  static void end();
+
+  static bool active() { return s_active; }
+  // kind as in AccessSampler: 0 unknown, 1 read, 2 write
+  static void add(uint64_t ns, uintptr_t addr, uintptr_t base, uint8_t kind);
+};
+
+} // namespace trac
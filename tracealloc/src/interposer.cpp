@@ -2,13 +2,25 @@
 #include <dlfcn.h>
 #include <errno.h>
 #include <pthread.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <stdio.h>
-#include <string.h>
 #include <time.h>
 
+#include "access.hpp"
+#include "arena.hpp"
+#include "clock.hpp"
 #include "handler.hpp"
+#include "heatmap.hpp"
+#include "mapregistry.hpp"
 #include "mappings.hpp"
+#include "residency.hpp"
+#include "roi.hpp"
+#include "stacks.hpp"
+#include "stats.hpp"
+#include "tags.hpp"
+#include "tracealloc.h"
+#include "writeset.hpp"
 #include "common.hpp"
 
 
@@ -27,17 +39,63 @@ extern "C" void   free(void * ptr);
 extern "C" void   cfree(void * ptr);
 extern "C" size_t malloc_usable_size(void * ptr);
 
+extern "C" void * mmap(void * addr, size_t length, int prot, int flags, int fd, off_t offset);
+extern "C" void * mmap64(void * addr, size_t length, int prot, int flags, int fd, off_t offset);
+extern "C" int    munmap(void * addr, size_t length);
+extern "C" void * mremap(void * addr, size_t oldsize, size_t size, int flags, ...);
+extern "C" int    brk(void * addr);
+extern "C" void * sbrk(intptr_t increment);
+
 
 static bool g_ready = false;
 static thread_local bool t_nested = false;
 static thread_local trac::Handler * t_handler = nullptr;
 
+void trac::setInternalThread()
+{
+  t_nested = true;
+}
+
+static pthread_key_t g_exitKey;
+static pthread_once_t g_exitKeyInit = PTHREAD_ONCE_INIT;
+
+static void retireHandler(void * handler)
+{
+  // allocations later during thread exit get a fresh handler
+  t_handler = nullptr;
+  bool nested = t_nested;
+  t_nested = true;
+  trac::Handler::retire((trac::Handler *)handler);
+  t_nested = nested;
+}
+
+static void initExitKey()
+{
+  pthread_key_create(&g_exitKey, retireHandler);
+}
+
+static trac::Handler * getHandler() // must be called with t_nested set
+{
+  pthread_once(&g_exitKeyInit, initExitKey);
+  trac::Handler * handler = trac::Handler::get();
+  pthread_setspecific(g_exitKey, handler);
+  return handler;
+}
+
 void __attribute__((constructor)) interposer_setup()
 {
   struct timespec wnow, pnow;
   clock_gettime(CLOCK_MONOTONIC_RAW, &wnow);
   clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &pnow);
   printf("TRAC_BEG:%ld.%09ld:%ld.%09ld\n", wnow.tv_sec, wnow.tv_nsec, pnow.tv_sec, pnow.tv_nsec);
+  trac::Clock::begin();
+  trac::Roi::begin();
+  trac::Stats::begin();
+  trac::MapRegistry::begin();
+  trac::Heatmap::begin();
+  trac::AccessSampler::begin();
+  trac::WriteSet::begin();
+  trac::Residency::begin();
   g_ready = true;
 }
 
@@ -49,8 +107,18 @@ void __attribute__((destructor)) interposer_teardown()
   clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &pnow);
   printf("TRAC_END:%ld.%09ld:%ld.%09ld\n", wnow.tv_sec, wnow.tv_nsec, pnow.tv_sec, pnow.tv_nsec);
   g_ready = false; // TODO-lw maybe after, as handler was initialized with g_ready = true?
+  trac::Clock::end();
+  trac::Roi::end();
+  trac::AccessSampler::end();
+  trac::Heatmap::end();
+  trac::WriteSet::end();
+  trac::Residency::end();
   trac::Handler::end();
+  trac::Stats::end();
+  trac::Tags::end();
+  trac::Stacks::end();
   trac::Mappings::end();
+  trac::Arena::report();
 }
 
 void * dlopen(const char * filename, int flags)
@@ -78,12 +146,12 @@ int    dlclose(void * handle)
 
 void * malloc(size_t size)
 {
-  if (!g_ready || t_nested) {
+  if (!g_ready || t_nested || !trac::Roi::traced()) {
     return trac::orig_malloc(size);
   } else {
     t_nested = true;
     if (!t_handler) {
-      t_handler = trac::Handler::get();
+      t_handler = getHandler();
     }
     void * res = t_handler->malloc(size);
     t_nested = false;
@@ -93,12 +161,12 @@ void * malloc(size_t size)
 
 void * calloc(size_t count, size_t unit)
 {
-  if (!g_ready || t_nested) {
+  if (!g_ready || t_nested || !trac::Roi::traced()) {
     return trac::orig_calloc(count, unit);
   } else {
     t_nested = true;
     if (!t_handler) {
-      t_handler = trac::Handler::get();
+      t_handler = getHandler();
     }
     void * res = t_handler->calloc(count, unit);
     t_nested = false;
@@ -108,12 +176,12 @@ void * calloc(size_t count, size_t unit)
 
 int    posix_memalign(void ** pptr, size_t bound, size_t size)
 {
-  if (!g_ready || t_nested) {
+  if (!g_ready || t_nested || !trac::Roi::traced()) {
     return trac::orig_posix_memalign(pptr, bound, size);
   } else {
     t_nested = true;
     if (!t_handler) {
-      t_handler = trac::Handler::get();
+      t_handler = getHandler();
     }
     int err = t_handler->memalign(pptr, bound, size);
     t_nested = false;
@@ -162,27 +230,15 @@ void * pvalloc(size_t size)
 
 void * realloc(void * ptr, size_t size)
 {
-  if (!g_ready || t_nested) {
+  // traced allocations are still followed outside of regions of interest
+  if (!g_ready || t_nested || (!trac::Roi::traced() && !trac::Registry::owns((uintptr_t)ptr))) {
     return trac::orig_realloc(ptr, size);
   } else {
     t_nested = true;
     if (!t_handler) {
-      t_handler = trac::Handler::get();
-    }
-    void * res = ptr;
-    if (!ptr) {
-      res = t_handler->malloc(size);
-    } else if (!t_handler->realloc(&res, size)) {
-      // ptr did not come from handlers, so transfer to new handler allocation
-      // TODO-lw usage of __malloc_usable_size seems buggy
-      size_t oldsize = trac::orig_malloc_usable_size(ptr);
-      res = t_handler->malloc(size);
-      if (oldsize < size) {
-        size = oldsize;
-      }
-      memcpy(res, ptr, size);
-      trac::orig_free(ptr);
+      t_handler = getHandler();
     }
+    void * res = ptr? t_handler->realloc(ptr, size) : t_handler->malloc(size);
     t_nested = false;
     return res;
   }
@@ -193,10 +249,15 @@ void   free(void * ptr)
   if (!ptr || trac::check_fallback(ptr)) {
     return;
   }
-  if (!g_ready || t_nested || !t_handler) {
+  if (!g_ready || t_nested || !trac::Registry::owns((uintptr_t)ptr)) {
+    // untracked allocations skip the handler entirely
     trac::orig_free(ptr);
   } else {
     t_nested = true;
+    // allocations are registered process-wide, so threads that only free still need a handler
+    if (!t_handler) {
+      t_handler = getHandler();
+    }
     if (!t_handler->free(ptr)) {
       trac::orig_free(ptr);
     }
@@ -214,11 +275,14 @@ size_t malloc_usable_size(void * ptr)
   if (!ptr) {
     return 0;
   }
-  if (!g_ready || t_nested || !t_handler) {
+  if (!g_ready || t_nested || (!trac::Roi::traced() && !trac::Registry::owns((uintptr_t)ptr))) {
     return trac::orig_malloc_usable_size(ptr);
   } else {
     size_t res = 0;
     t_nested = true;
+    if (!t_handler) {
+      t_handler = getHandler();
+    }
     if (!t_handler->getsize(ptr, &res)) {
       res = trac::orig_malloc_usable_size(ptr);
     }
@@ -227,3 +291,110 @@ size_t malloc_usable_size(void * ptr)
   }
 }
 
+// Mappings of the tracer and of memkind are made with t_nested set, and glibc maps
+//   its own heaps and thread stacks internally, so only the program's reach here.
+void * mmap(void * addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+  if (!g_ready || t_nested || !trac::MapRegistry::mode() || !trac::Roi::traced()) {
+    return trac::orig_mmap(addr, length, prot, flags, fd, offset);
+  } else {
+    t_nested = true;
+    if (!t_handler) {
+      t_handler = getHandler();
+    }
+    void * res = t_handler->mmap(addr, length, prot, flags, fd, offset);
+    t_nested = false;
+    return res;
+  }
+}
+
+void * mmap64(void * addr, size_t length, int prot, int flags, int fd, off_t offset)
+{
+  return mmap(addr, length, prot, flags, fd, offset);
+}
+
+int    munmap(void * addr, size_t length)
+{
+  if (!g_ready || t_nested || trac::MapRegistry::empty()) {
+    return trac::orig_munmap(addr, length);
+  } else {
+    t_nested = true;
+    if (!t_handler) {
+      t_handler = getHandler();
+    }
+    int res = t_handler->munmap(addr, length);
+    t_nested = false;
+    return res;
+  }
+}
+
+void * mremap(void * addr, size_t oldsize, size_t size, int flags, ...)
+{
+  void * newaddr = nullptr;
+  if (flags & MREMAP_FIXED) {
+    va_list args;
+    va_start(args, flags);
+    newaddr = va_arg(args, void *);
+    va_end(args);
+  }
+  if (!g_ready || t_nested || trac::MapRegistry::empty()) {
+    return trac::orig_mremap(addr, oldsize, size, flags, newaddr);
+  } else {
+    t_nested = true;
+    if (!t_handler) {
+      t_handler = getHandler();
+    }
+    void * res = t_handler->mremap(addr, oldsize, size, flags, newaddr);
+    t_nested = false;
+    return res;
+  }
+}
+
+int    brk(void * addr)
+{
+  if (!g_ready || t_nested || !trac::MapRegistry::mode()) {
+    return trac::orig_brk(addr);
+  } else {
+    t_nested = true;
+    if (!t_handler) {
+      t_handler = getHandler();
+    }
+    int res = t_handler->brk(addr);
+    t_nested = false;
+    return res;
+  }
+}
+
+void * sbrk(intptr_t increment)
+{
+  if (!g_ready || t_nested || !trac::MapRegistry::mode() || !increment) {
+    return trac::orig_sbrk(increment);
+  } else {
+    t_nested = true;
+    if (!t_handler) {
+      t_handler = getHandler();
+    }
+    void * res = t_handler->sbrk(increment);
+    t_nested = false;
+    return res;
+  }
+}
+
+void   trac_tag(void * ptr, const char * name)
+{
+  trac_tag_range(ptr, 0, name);
+}
+
+void   trac_tag_range(void * ptr, size_t size, const char * name)
+{
+  // most untraced allocations are rejected by the granule check already
+  if (!ptr || !g_ready || t_nested || (!size && !trac::Registry::owns((uintptr_t)ptr) && trac::MapRegistry::empty())) {
+    return;
+  }
+  t_nested = true;
+  if (!t_handler) {
+    t_handler = getHandler();
+  }
+  t_handler->tag(ptr, size, name);
+  t_nested = false;
+}
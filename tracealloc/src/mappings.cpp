@@ -1,5 +1,10 @@
 #include "mappings.hpp"
 
+#include <algorithm>
+
+#include <sched.h>
+#include <stddef.h>
+#include <sys/mman.h>
 #include <unistd.h>
 
 
@@ -14,17 +19,18 @@ Mappings::Entry::Entry(size_t index, size_t base, size_t size, size_t offset)
 { }
 
 Mappings * Mappings::s_instance = nullptr;
-pthread_rwlock_t Mappings::s_lock;
-pthread_once_t Mappings::s_lockInit = PTHREAD_ONCE_INIT;
-
-void Mappings::initLock()
-{
-  pthread_rwlock_init(&s_lock, nullptr);
-}
+pthread_mutex_t Mappings::s_guard = PTHREAD_MUTEX_INITIALIZER;
+Mappings::Snapshot * Mappings::s_current = nullptr;
+unsigned long Mappings::s_epoch = 0;
+unsigned long Mappings::s_readers[2] = {0, 0};
 
 Mappings::Mappings()
 : m_libs()
-, m_entries()
+, m_added()
+, m_adds(0)
+, m_subs(0)
+, m_visited(0)
+, m_rescan(true)
 , m_log(nullptr)
 {
   char * logpath = getenv("TRAC_LOGPATH");
@@ -33,7 +39,6 @@ Mappings::Mappings()
     snprintf(logfilename, sizeof(logfilename), "%s/maps.log", logpath);
     m_log = fopen(logfilename, "w");
   }
-  doUpdate();
 }
 
 Mappings::~Mappings()
@@ -43,15 +48,62 @@ Mappings::~Mappings()
   }
 }
 
-void Mappings::doUpdate()
+void Mappings::doUpdate() // must be called holding s_guard
 {
-  m_entries.clear();
+  const Snapshot * current = s_current;
+  m_rescan = !current;
+  m_added.clear();
+  m_visited = 0;
   dl_iterate_phdr(&updateCallback, this);
+  if (m_added.empty() && !m_rescan) {
+    return;
+  }
+  size_t kept = m_rescan? 0 : current->count;
+  Snapshot * snapshot = createSnapshot(kept + m_added.size());
+  if (!snapshot) {
+    return;
+  }
+  std::sort(m_added.begin(), m_added.end(),
+            [](const Entry & a, const Entry & b) { return a.base < b.base; });
+  if (kept) {
+    std::merge(current->entries, current->entries + kept, m_added.begin(), m_added.end(), snapshot->entries,
+               [](const Entry & a, const Entry & b) { return a.base < b.base; });
+  } else {
+    std::copy(m_added.begin(), m_added.end(), snapshot->entries);
+  }
+  m_added.clear();
+  publish(snapshot);
 }
 
 int Mappings::updateCallback(struct dl_phdr_info * info, size_t size, void * data)
 {
   Mappings * obj = (Mappings *)data;
+  if (!obj->m_visited++) {
+    // the loader counts objects added and removed so far, the first callback checks for changes
+    if (size < offsetof(struct dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs)) {
+      obj->m_rescan = true;
+    } else {
+      if (!obj->m_rescan && info->dlpi_adds == obj->m_adds && info->dlpi_subs == obj->m_subs) {
+        return 1;
+      }
+      if (info->dlpi_subs != obj->m_subs) {
+        obj->m_rescan = true;
+      }
+      obj->m_adds = info->dlpi_adds;
+      obj->m_subs = info->dlpi_subs;
+    }
+  }
+  // without removals, objects whose first segment is already mapped are unchanged
+  if (!obj->m_rescan) {
+    for (size_t i = 0; i < info->dlpi_phnum; ++i) {
+      if (info->dlpi_phdr[i].p_type == PT_LOAD) {
+        if (contains(s_current, info->dlpi_addr + info->dlpi_phdr[i].p_vaddr)) {
+          return 0;
+        }
+        break;
+      }
+    }
+  }
   size_t index = obj->getIndex(info->dlpi_name);
   // printf("[%ld] @%lx %s:\n", index, info->dlpi_addr, info->dlpi_name);
   for (size_t i = 0; i < info->dlpi_phnum; ++i) {
@@ -68,7 +120,7 @@ int Mappings::updateCallback(struct dl_phdr_info * info, size_t size, void * dat
 
 size_t Mappings::getIndex(const char * filename)
 {
-  auto it = m_libs.find(filename);
+  auto it = m_libs.find(ArenaString(filename));
   if (it != m_libs.end()) {
     return it->second;
   } else {
@@ -76,6 +128,7 @@ size_t Mappings::getIndex(const char * filename)
     m_libs.emplace(filename, idx);
     if (m_log) {
       fprintf(m_log, "%ld: %s\n", idx, filename);
+      fflush(m_log);
     }
     return idx;
   }
@@ -84,22 +137,66 @@ size_t Mappings::getIndex(const char * filename)
 void Mappings::putMapping(size_t index, uintptr_t base, size_t size, size_t offset)
 {
   // printf("MAP %lx to %lx   [%ld @%lx]\n", base, base+size, index, offset);
-  m_entries.emplace(base, Entry(index, base, size, offset));
+  m_added.emplace_back(index, base, size, offset);
+}
+
+Mappings::Snapshot * Mappings::createSnapshot(size_t count)
+{
+  size_t mapped = sizeof(Snapshot) + count * sizeof(Entry);
+  void * mem = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    return nullptr;
+  }
+  Snapshot * snapshot = (Snapshot *)mem;
+  snapshot->count = count;
+  snapshot->mapped = mapped;
+  snapshot->entries = (Entry *)(snapshot + 1);
+  return snapshot;
+}
+
+void Mappings::publish(Snapshot * snapshot) // must be called holding s_guard
+{
+  Snapshot * old = __atomic_exchange_n(&s_current, snapshot, __ATOMIC_SEQ_CST);
+  if (old) {
+    synchronize();
+    munmap(old, old->mapped);
+  }
 }
 
+void Mappings::synchronize() // must be called holding s_guard
+{
+  // readers register in the counter of the epoch they entered, after switching
+  //   epochs only readers of the previous one may still hold the old snapshot
+  unsigned long epoch = __atomic_fetch_add(&s_epoch, 1, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&s_readers[epoch & 1], __ATOMIC_SEQ_CST)) {
+    sched_yield();
+  }
+}
+
+bool Mappings::contains(const Snapshot * snapshot, uintptr_t base)
+{
+  const Entry * begin = snapshot->entries;
+  const Entry * end = begin + snapshot->count;
+  const Entry * it = std::lower_bound(begin, end, base,
+                                      [](const Entry & e, uintptr_t base) { return e.base < base; });
+  return it != end && it->base == base;
+}
 
-void Mappings::doLookup(uintptr_t vaddr, Mappings::LibAddr & laddr) const
+void Mappings::doLookup(const Snapshot * snapshot, uintptr_t vaddr, Mappings::LibAddr & laddr)
 {
-  auto it = m_entries.upper_bound(vaddr);
-  if (it == m_entries.cbegin()) {
+  const Entry * begin = snapshot? snapshot->entries : nullptr;
+  const Entry * end = snapshot? snapshot->entries + snapshot->count : nullptr;
+  const Entry * it = std::upper_bound(begin, end, vaddr,
+                                      [](uintptr_t vaddr, const Entry & e) { return vaddr < e.base; });
+  if (it == begin) {
     laddr.index = 0;
     laddr.offset = vaddr;
   } else {
     --it;
-    size_t rel = vaddr - it->second.base;
-    if (rel < it->second.size) {
-      laddr.index = it->second.index;
-      laddr.offset = rel + it->second.offset;
+    size_t rel = vaddr - it->base;
+    if (rel < it->size) {
+      laddr.index = it->index;
+      laddr.offset = rel + it->offset;
     } else {
       laddr.index = 0;
       laddr.offset = vaddr;
@@ -108,61 +205,50 @@ void Mappings::doLookup(uintptr_t vaddr, Mappings::LibAddr & laddr) const
 }
 
 
-//void Mappings::setup()
-//{
-//  pthread_rwlock_wrlock(&s_lock);
-//  if (!s_instance) {
-//    s_instance = new Mappings();
-//  }
-//  pthread_rwlock_unlock(&s_lock);
-//}
-
 void Mappings::end()
 {
-  auto tid = gettid();
-  pthread_once(&s_lockInit, initLock);
-  //printf("[%09d] end() - wrlock(%p);\n", tid, &s_lock);
-  pthread_rwlock_wrlock(&s_lock);
+  pthread_mutex_lock(&s_guard);
+  if (s_current) {
+    Snapshot * old = __atomic_exchange_n(&s_current, (Snapshot *)nullptr, __ATOMIC_SEQ_CST);
+    synchronize();
+    munmap(old, old->mapped);
+  }
   if (s_instance) {
     delete s_instance;
     s_instance = nullptr;
   }
-  //printf("[%09d] end() - unlock(%p);\n", tid, &s_lock);
-  pthread_rwlock_unlock(&s_lock);
+  pthread_mutex_unlock(&s_guard);
 }
 
 void Mappings::update()
 {
-  auto tid = gettid();
-  pthread_once(&s_lockInit, initLock);
-  //printf("[%09d] update() - wrlock(%p);\n", tid, &s_lock);
-  pthread_rwlock_wrlock(&s_lock);
+  pthread_mutex_lock(&s_guard);
   if (!s_instance) {
     s_instance = new Mappings();
   }
-  s_instance->doUpdate();
-  //printf("[%09d] update() - unlock(%p);\n", tid, &s_lock);
-  pthread_rwlock_unlock(&s_lock);
+  if (s_instance) {
+    s_instance->doUpdate();
+  }
+  pthread_mutex_unlock(&s_guard);
 }
 
 void Mappings::lookup(uintptr_t vaddr, Mappings::LibAddr & laddr)
 {
-  auto tid = gettid();
-  pthread_once(&s_lockInit, initLock);
-  //printf("[%09d] lookup() - rdlock(%p);\n", tid, &s_lock);
-  pthread_rwlock_rdlock(&s_lock);
-  if (!s_instance) {
-    //printf("[%09d] lookup() - unlock(%p);\n", tid, &s_lock);
-    pthread_rwlock_unlock(&s_lock);
-    //printf("[%09d] lookup() - wrlock(%p);\n", tid, &s_lock);
-    pthread_rwlock_wrlock(&s_lock);
-    if (!s_instance) {
-      s_instance = new Mappings();
+  if (!__atomic_load_n(&s_current, __ATOMIC_ACQUIRE)) {
+    update();
+  }
+  unsigned long epoch;
+  while (true) {
+    epoch = __atomic_load_n(&s_epoch, __ATOMIC_SEQ_CST);
+    __atomic_fetch_add(&s_readers[epoch & 1], 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&s_epoch, __ATOMIC_SEQ_CST) == epoch) {
+      break;
     }
+    // an update switched epochs in between, it may not have seen this reader
+    __atomic_fetch_sub(&s_readers[epoch & 1], 1, __ATOMIC_SEQ_CST);
   }
-  s_instance->doLookup(vaddr, laddr);
-  //printf("[%09d] lookup() - unlock(%p);\n", tid, &s_lock);
-  pthread_rwlock_unlock(&s_lock);
+  doLookup(__atomic_load_n(&s_current, __ATOMIC_ACQUIRE), vaddr, laddr);
+  __atomic_fetch_sub(&s_readers[epoch & 1], 1, __ATOMIC_RELEASE);
 }
 
 
@@ -1,18 +1,22 @@
 #pragma once
 
-#include <string>
-#include <map>
-
 #include <link.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "arena.hpp"
+
 
 namespace trac
 {
 
-class Mappings
+// Maps code addresses to (library index, file offset) pairs.
+// Readers search an immutable snapshot sorted by base address without locking.
+//   update() builds a new snapshot from the previous one, scanning only newly
+//   loaded objects unless objects were unloaded, publishes it and frees the
+//   old one once no reader can still hold it.
+class Mappings : public ArenaObject
 {
 public:
 
@@ -33,14 +37,25 @@ public:
   };
 
 private:
-  static Mappings * s_instance;
-  static pthread_rwlock_t s_lock;
-  static pthread_once_t s_lockInit;
-
-  static void initLock();
+  struct Snapshot
+  {
+    size_t count;
+    size_t mapped;
+    Entry * entries;
+  };
 
-  std::map<std::string, size_t> m_libs;
-  std::map<uintptr_t, Entry> m_entries;
+  static Mappings * s_instance;
+  static pthread_mutex_t s_guard;
+  static Snapshot * s_current;
+  static unsigned long s_epoch;
+  static unsigned long s_readers[2];
+
+  ArenaMap<ArenaString, size_t> m_libs;
+  ArenaVector<Entry> m_added;
+  unsigned long long m_adds;
+  unsigned long long m_subs;
+  size_t m_visited;
+  bool m_rescan;
   FILE * m_log;
 
   Mappings();
@@ -51,7 +66,11 @@ private:
   size_t getIndex(const char * filename);
   void putMapping(size_t index, uintptr_t base, size_t size, size_t offset);
 
-  void doLookup(uintptr_t vaddr, LibAddr & laddr) const;
+  static Snapshot * createSnapshot(size_t count);
+  static void publish(Snapshot * snapshot);
+  static void synchronize();
+  static bool contains(const Snapshot * snapshot, uintptr_t base);
+  static void doLookup(const Snapshot * snapshot, uintptr_t vaddr, LibAddr & laddr);
 
 public:
   static void end();
@@ -0,0 +1,115 @@
+#include "mapregistry.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+
+
+namespace trac
+{
+
+MapRegistry::Mode MapRegistry::s_mode = MapRegistry::Off;
+pthread_mutex_t MapRegistry::s_guard = PTHREAD_MUTEX_INITIALIZER;
+MapRegistry::Regions * MapRegistry::s_regions = nullptr;
+std::atomic<size_t> MapRegistry::s_count(0);
+
+void MapRegistry::begin()
+{
+  const char * maps = getenv("TRAC_MAPS");
+  if (!maps || !*maps || !strcmp(maps, "0")) {
+    return;
+  }
+  if (!strcmp(maps, "place")) {
+    s_mode = Place;
+  } else {
+    if (strcmp(maps, "trace") && strcmp(maps, "1")) {
+      printf("TRAC_MAPS=%s is unknown, using trace\n", maps);
+    }
+    s_mode = Trace;
+  }
+  s_regions = new (Arena::allocate(sizeof(Regions))) Regions();
+}
+
+MapRegistry::Regions::iterator MapRegistry::overlap(uintptr_t begin, uintptr_t end) // must hold s_guard
+{
+  auto it = s_regions->upper_bound(begin);
+  if (it != s_regions->begin()) {
+    auto prev = std::prev(it);
+    if (prev->first + prev->second.size > begin) {
+      return prev;
+    }
+  }
+  if (it != s_regions->end() && it->first < end) {
+    return it;
+  }
+  return s_regions->end();
+}
+
+void MapRegistry::insert(uintptr_t base, const Region & region)
+{
+  pthread_mutex_lock(&s_guard);
+  auto res = s_regions->emplace(base, region);
+  if (res.second) {
+    s_count.fetch_add(1, std::memory_order_relaxed);
+  } else {
+    res.first->second = region;
+  }
+  pthread_mutex_unlock(&s_guard);
+}
+
+bool MapRegistry::take(uintptr_t begin, uintptr_t end, uintptr_t & base, Region & region)
+{
+  pthread_mutex_lock(&s_guard);
+  auto it = overlap(begin, end);
+  bool found = it != s_regions->end();
+  if (found) {
+    base = it->first;
+    region = it->second;
+    s_regions->erase(it);
+    s_count.fetch_sub(1, std::memory_order_relaxed);
+  }
+  pthread_mutex_unlock(&s_guard);
+  return found;
+}
+
+bool MapRegistry::lookup(uintptr_t addr, uintptr_t & base, Region & region)
+{
+  pthread_mutex_lock(&s_guard);
+  auto it = overlap(addr, addr + 1);
+  bool found = it != s_regions->end();
+  if (found) {
+    base = it->first;
+    region = it->second;
+  }
+  pthread_mutex_unlock(&s_guard);
+  return found;
+}
+
+bool MapRegistry::tag(uintptr_t base, uint32_t tag, Region & region)
+{
+  pthread_mutex_lock(&s_guard);
+  auto it = s_regions->find(base);
+  bool found = it != s_regions->end() && it->second.traced;
+  if (found) {
+    region = it->second;
+    it->second.tag = tag;
+  }
+  pthread_mutex_unlock(&s_guard);
+  return found;
+}
+
+void MapRegistry::forEach(Visitor visitor, void * data)
+{
+  if (!s_regions) {
+    return;
+  }
+  pthread_mutex_lock(&s_guard);
+  for (const auto & entry : *s_regions) {
+    visitor(entry.first, entry.second, data);
+  }
+  pthread_mutex_unlock(&s_guard);
+}
+
+} // namespace trac
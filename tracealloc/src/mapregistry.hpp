@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "arena.hpp"
+
+
+namespace trac
+{
+
+// Regions the program maps itself with mmap, mremap and brk/sbrk, enabled by
+//   TRAC_MAPS=trace, or TRAC_MAPS=place to also apply pages and NUMA placement
+//   of the Policy to private anonymous ones.
+// Unlike Registry entries, regions are cut by partial munmap, mremap and
+//   shrinking brk, so they are kept ordered by address. Untraced regions are
+//   recorded too, so their origin is known if they are grown by mremap.
+class MapRegistry
+{
+public:
+  enum Mode : uint8_t
+  {
+    Off,
+    Trace,
+    Place,
+  };
+
+  struct Region
+  {
+    size_t size;
+    uint64_t offset; // into the file, advanced for the tail of a cut region
+    uint32_t owner;
+    uint32_t stack;
+    uint32_t file;   // Tags id of the file's path, 0 if anonymous or unknown
+    uint32_t tag;    // Tags id, 0 if untagged
+    uint8_t flags;   // see MapInfo flags
+    uint8_t pages;   // AllocEvent flags
+    bool traced;
+  };
+
+  typedef void (*Visitor)(uintptr_t base, const Region & region, void * data);
+
+private:
+  typedef ArenaMap<uintptr_t, Region> Regions;
+
+  static Mode s_mode;
+  static pthread_mutex_t s_guard;
+  static Regions * s_regions;
+  static std::atomic<size_t> s_count;
+
+  static Regions::iterator overlap(uintptr_t begin, uintptr_t end);
+
+public:
+  static void begin();
+
+  static Mode mode() { return s_mode; }
+  // true if no region is recorded, without locking
+  static bool empty() { return !s_count.load(std::memory_order_relaxed); }
+
+  static void insert(uintptr_t base, const Region & region);
+  // removes the lowest region overlapping [begin, end)
+  static bool take(uintptr_t begin, uintptr_t end, uintptr_t & base, Region & region);
+  // region containing addr
+  static bool lookup(uintptr_t addr, uintptr_t & base, Region & region);
+  // names the region starting at base, region receives it with the previous tag
+  static bool tag(uintptr_t base, uint32_t tag, Region & region);
+
+  // Calls visitor for each region while holding the lock,
+  //   so visitor must not call back into the MapRegistry.
+  static void forEach(Visitor visitor, void * data);
+};
+
+} // namespace trac
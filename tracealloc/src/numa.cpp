@@ -0,0 +1,170 @@
+#include "numa.hpp"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <linux/mempolicy.h>
+
+
+namespace trac
+{
+
+pthread_once_t Numa::s_init = PTHREAD_ONCE_INIT;
+Numa::Mode Numa::s_mode = Numa::NoPlacement;
+int Numa::s_node = 0;
+unsigned long Numa::s_online = 1;
+
+bool Numa::readList(const char * path, cpu_set_t & set)
+{
+  // list of ranges like 0-1,3
+  CPU_ZERO(&set);
+  FILE * file = fopen(path, "r");
+  if (!file) {
+    return false;
+  }
+  char list[1024];
+  if (fgets(list, sizeof(list), file)) {
+    char * pos = list;
+    while (*pos >= '0' && *pos <= '9') {
+      long first = strtol(pos, &pos, 10);
+      long last = (*pos == '-')? strtol(pos + 1, &pos, 10) : first;
+      for (long index = first; index <= last && index < CPU_SETSIZE; ++index) {
+        CPU_SET(index, &set);
+      }
+      if (*pos == ',') {
+        ++pos;
+      }
+    }
+  }
+  fclose(file);
+  return CPU_COUNT(&set) > 0;
+}
+
+unsigned long Numa::readOnline()
+{
+  cpu_set_t set;
+  if (!readList("/sys/devices/system/node/has_memory", set) &&
+      !readList("/sys/devices/system/node/online", set)) {
+    return 1; // no NUMA support, everything is node 0
+  }
+  unsigned long mask = 0;
+  for (int node = 0; node < MaxNodes; ++node) {
+    if (CPU_ISSET(node, &set)) {
+      mask |= 1ul << node;
+    }
+  }
+  return mask? mask : 1;
+}
+
+bool Numa::cpus(int node, cpu_set_t & set)
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+  return readList(path, set);
+}
+
+void Numa::init()
+{
+  const char * mode = getenv("TRAC_NUMA");
+  if (!mode) {
+    return;
+  }
+  s_online = readOnline();
+  if (!strcmp(mode, "local")) {
+    s_mode = LocalNode;
+  } else if (!strcmp(mode, "interleave")) {
+    s_mode = Interleave;
+  } else {
+    char * end;
+    long node = strtol(mode, &end, 0);
+    if (end == mode || *end || node < 0 || node >= MaxNodes || !(s_online & (1ul << node))) {
+      printf("TRAC_NUMA=%s is no online node, using default policy\n", mode);
+      return;
+    }
+    s_mode = ExplicitNode;
+    s_node = node;
+  }
+  printf("TRAC_NUMA %s: %d nodes\n", mode, __builtin_popcountl(s_online));
+}
+
+Numa::Mode Numa::mode()
+{
+  pthread_once(&s_init, init);
+  return s_mode;
+}
+
+int Numa::currentNode()
+{
+  unsigned int cpu, node;
+  if (getcpu(&cpu, &node)) {
+    return 0;
+  }
+  return node;
+}
+
+bool Numa::place(void * ptr, size_t size, int cpuNode, int & node)
+{
+  static const size_t page = sysconf(_SC_PAGESIZE);
+  uintptr_t begin = ((uintptr_t)ptr + page - 1) & ~(page - 1);
+  uintptr_t end = ((uintptr_t)ptr + size) & ~(page - 1);
+  int policy = MPOL_BIND;
+  unsigned long mask;
+  switch (s_mode) {
+  case LocalNode:
+    if (cpuNode < 0 || cpuNode >= MaxNodes || !(s_online & (1ul << cpuNode))) {
+      return false; // memoryless node, leave it to the kernel's fallback
+    }
+    node = cpuNode;
+    mask = 1ul << node;
+    break;
+  case ExplicitNode:
+    node = s_node;
+    mask = 1ul << node;
+    break;
+  case Interleave:
+    node = -1;
+    policy = MPOL_INTERLEAVE;
+    mask = s_online;
+    break;
+  default:
+    return false;
+  }
+  if (begin >= end) {
+    return false; // the allocation covers no page of its own
+  }
+  // raw syscall, to avoid depending on libnuma for this alone
+  if (syscall(SYS_mbind, begin, end - begin, policy, &mask, MaxNodes + 1, MPOL_MF_MOVE)) {
+    printf("TRAC_NUMA placement failed (errno %d), using default policy\n", errno);
+    s_mode = NoPlacement;
+    return false;
+  }
+  return true;
+}
+
+size_t Numa::sample(uintptr_t first, size_t pages, size_t page, size_t (&perNode)[MaxNodes])
+{
+  void * samples[SamplePages];
+  int status[SamplePages];
+  size_t count = (pages < SamplePages)? pages : SamplePages;
+  for (size_t idx = 0; idx < count; ++idx) {
+    samples[idx] = (void *)(first + (idx * pages / count) * page);
+  }
+  size_t sampled = 0;
+  // without target nodes move_pages only reports where the pages are
+  if (count && !syscall(SYS_move_pages, 0, count, samples, nullptr, status, 0)) {
+    for (size_t idx = 0; idx < count; ++idx) {
+      if (status[idx] >= 0 && status[idx] < MaxNodes) {
+        ++perNode[status[idx]];
+        ++sampled;
+      }
+    }
+  }
+  return sampled;
+}
+
+} // namespace trac
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+
+
+namespace trac
+{
+
+// NUMA placement of traced DRAM allocations, selected by TRAC_NUMA:
+//   local       binds to the node of the allocating thread's cpu
+//   interleave  spreads pages round robin over all online nodes
+//   <node>      binds to the given node
+// Only the pages lying entirely within an allocation are bound, as memkind's
+//   DRAM kinds have no per node variant. Pages already touched are migrated.
+// On single node machines every mode degenerates to node 0.
+class Numa
+{
+public:
+  enum Mode : uint8_t
+  {
+    NoPlacement,
+    LocalNode,
+    Interleave,
+    ExplicitNode,
+  };
+
+  static constexpr int MaxNodes = 64; // nodemasks are a single word
+  static constexpr size_t SamplePages = 64;
+
+private:
+  static pthread_once_t s_init;
+  static Mode s_mode;
+  static int s_node;             // for ExplicitNode
+  static unsigned long s_online; // mask of nodes with memory
+
+  static void init();
+  static bool readList(const char * path, cpu_set_t & set);
+  static unsigned long readOnline();
+
+public:
+  static Mode mode();
+
+  // node of the cpu the calling thread runs on
+  static int currentNode();
+  // cpus of a node, false if it has none
+  static bool cpus(int node, cpu_set_t & set);
+  // binds [ptr, ptr + size) according to the mode, returns false if not applied
+  static bool place(void * ptr, size_t size, int cpuNode, int & node);
+  // counts per node where up to SamplePages pages evenly spread over the
+  //   pages [first, first + pages * page) are, returns the pages counted
+  static size_t sample(uintptr_t first, size_t pages, size_t page, size_t (&perNode)[MaxNodes]);
+};
+
+} // namespace trac
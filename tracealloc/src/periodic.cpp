@@ -0,0 +1,56 @@
+#include "periodic.hpp"
+
+#include <errno.h>
+#include <time.h>
+
+#include "common.hpp"
+
+
+namespace trac
+{
+
+bool Periodic::start(uint64_t period, Tick tick, bool last)
+{
+  pthread_mutex_init(&m_guard, nullptr);
+  pthread_cond_init(&m_wakeup, nullptr);
+  m_period = period;
+  m_tick = tick;
+  m_last = last;
+  m_stop = false;
+  return !pthread_create(&m_thread, nullptr, &threadMain, this);
+}
+
+void Periodic::stop()
+{
+  pthread_mutex_lock(&m_guard);
+  m_stop = true;
+  pthread_cond_signal(&m_wakeup);
+  pthread_mutex_unlock(&m_guard);
+  pthread_join(m_thread, nullptr);
+}
+
+void * Periodic::threadMain(void * arg)
+{
+  setInternalThread();
+  Periodic & self = *(Periodic *)arg;
+  pthread_mutex_lock(&self.m_guard);
+  while (!self.m_stop) {
+    // condition variables wait on CLOCK_REALTIME
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    uint64_t deadline = until.tv_nsec + self.m_period;
+    until.tv_sec += deadline / 1000000000ull;
+    until.tv_nsec = deadline % 1000000000ull;
+    while (!self.m_stop && pthread_cond_timedwait(&self.m_wakeup, &self.m_guard, &until) != ETIMEDOUT);
+    if (self.m_stop && !self.m_last) {
+      break;
+    }
+    pthread_mutex_unlock(&self.m_guard);
+    self.m_tick();
+    pthread_mutex_lock(&self.m_guard);
+  }
+  pthread_mutex_unlock(&self.m_guard);
+  return nullptr;
+}
+
+} // namespace trac
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+
+namespace trac
+{
+
+// Internal thread calling a function every period until stopped, shared by the
+//   samplers of WriteSet and Residency. Objects are static and zero initialized,
+//   start() sets them up.
+class Periodic
+{
+public:
+  typedef void (*Tick)();
+
+private:
+  pthread_t m_thread;
+  pthread_mutex_t m_guard;
+  pthread_cond_t m_wakeup;
+  uint64_t m_period; // in ns
+  Tick m_tick;
+  bool m_last;
+  bool m_stop;
+
+  static void * threadMain(void * arg);
+
+public:
+  // last also ticks once when stopped, ending the current period early
+  bool start(uint64_t period, Tick tick, bool last);
+  void stop();
+};
+
+} // namespace trac
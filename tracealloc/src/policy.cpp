@@ -0,0 +1,273 @@
+#include "policy.hpp"
+
+#include <algorithm>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stacks.hpp"
+
+
+namespace trac
+{
+
+Policy * Policy::s_instance = nullptr;
+pthread_once_t Policy::s_load = PTHREAD_ONCE_INIT;
+
+Policy::Policy()
+: m_kinds()
+, m_rules()
+, m_bounds()
+, m_default(1)
+{
+  m_kinds.push_back(Kind{"dram", MEMKIND_DEFAULT, false});
+  m_kinds.push_back(Kind{"pmem", nullptr, false});
+}
+
+void Policy::load()
+{
+  const char * path = getenv("TRAC_POLICY");
+  if (!path) {
+    return;
+  }
+  FILE * file = fopen(path, "r");
+  if (!file) {
+    printf("TRAC_POLICY %s: can not open\n", path);
+    return;
+  }
+  Policy * policy = new Policy();
+  if (!policy) {
+    printf("TRAC_POLICY %s: out of memory\n", path);
+    fclose(file);
+    return;
+  }
+  char line[1024];
+  size_t lineno = 0;
+  while (fgets(line, sizeof(line), file)) {
+    ++lineno;
+    if (!policy->parse(line)) {
+      printf("TRAC_POLICY %s:%ld: ignoring invalid line\n", path, lineno);
+    }
+  }
+  fclose(file);
+  std::sort(policy->m_bounds.begin(), policy->m_bounds.end());
+  policy->m_bounds.erase(std::unique(policy->m_bounds.begin(), policy->m_bounds.end()), policy->m_bounds.end());
+  printf("TRAC_POLICY %s: %ld kinds, %ld rules\n", path, policy->m_kinds.size(), policy->m_rules.size());
+  s_instance = policy;
+}
+
+static bool parseNumber(const char * text, uint64_t & value, const char ** end)
+{
+  char * pos = nullptr;
+  value = strtoull(text, &pos, 0);
+  *end = pos;
+  return pos != text;
+}
+
+static bool parseRange(const char * text, uint64_t & min, uint64_t & max)
+{
+  const char * pos = text;
+  if (!parseNumber(pos, min, &pos)) {
+    return false;
+  }
+  if (!*pos) {
+    max = min;
+    return true;
+  }
+  if (*pos++ != '-') {
+    return false;
+  }
+  if (!*pos) {
+    max = ~0ull;
+    return true;
+  }
+  return parseNumber(pos, max, &pos) && !*pos && min <= max;
+}
+
+bool Policy::parse(char * line)
+{
+  const char * args[8];
+  size_t count = 0;
+  char * save = nullptr;
+  for (char * word = strtok_r(line, " \t\r\n", &save); word; word = strtok_r(nullptr, " \t\r\n", &save)) {
+    if (word[0] == '#') {
+      break;
+    }
+    if (count == sizeof(args) / sizeof(args[0])) {
+      return false;
+    }
+    args[count++] = word;
+  }
+  if (!count) {
+    return true;
+  }
+
+  if (!strcmp(args[0], "kind")) {
+    return (count == 3 || count == 4) && addKind(args[1], args[2], (count == 4)? args[3] : nullptr);
+  }
+  if (!strcmp(args[0], "default")) {
+    return count == 2 && findKind(args[1], m_default);
+  }
+  Rule rule = {false, 0, {0, ~0ull}, 0, {0, ~0ull}, {0, ~0ull}};
+  if (!strcmp(args[0], "place") && count >= 2) {
+    if (!findKind(args[1], rule.kind)) {
+      return false;
+    }
+  } else if (!strcmp(args[0], "pages") && count >= 2) {
+    rule.pages = true;
+    if (!strcmp(args[1], "thp")) {
+      rule.kind = TransparentHugePages;
+    } else if (!strcmp(args[1], "hugetlb")) {
+      rule.kind = HugetlbPages;
+    } else if (!strcmp(args[1], "4k")) {
+      rule.kind = SmallPages;
+    } else if (!strcmp(args[1], "default")) {
+      rule.kind = DefaultPages;
+    } else {
+      return false;
+    }
+  } else {
+    return false;
+  }
+  if (!parseCriteria(args + 2, count - 2, rule)) {
+    return false;
+  }
+  m_bounds.push_back(rule.size.min);
+  if (rule.size.max != ~0ull) {
+    m_bounds.push_back(rule.size.max + 1);
+  }
+  m_rules.push_back(rule);
+  return true;
+}
+
+bool Policy::parseCriteria(const char * const * args, size_t count, Rule & rule)
+{
+  for (size_t idx = 0; idx < count; ++idx) {
+    const char * value = strchr(args[idx], '=');
+    if (!value) {
+      return false;
+    }
+    ArenaString key(args[idx], value++ - args[idx]);
+    bool ok;
+    if (key == "size") {
+      ok = parseRange(value, rule.size.min, rule.size.max);
+    } else if (key == "lib") {
+      const char * end;
+      uint64_t lib;
+      ok = parseNumber(value, lib, &end) && !*end && lib;
+      rule.lib = lib;
+    } else if (key == "offset") {
+      ok = parseRange(value, rule.offset.min, rule.offset.max);
+    } else if (key == "thread") {
+      ok = parseRange(value, rule.thread.min, rule.thread.max);
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Policy::addKind(const char * name, const char * dir, const char * size)
+{
+  size_t index;
+  if (strlen(name) >= sizeof(Kind::name) || findKind(name, index)) {
+    return false;
+  }
+  size_t bytes = size? strtoull(size, nullptr, 0) : 0;
+  if (!bytes) {
+    bytes = 1ULL << 32; // default to 4 GiB, as for TRAC_PMEMDIR
+  }
+  Kind kind = {"", nullptr, true};
+  strcpy(kind.name, name);
+  int err = memkind_create_pmem(dir, bytes, &kind.kind);
+  if (err) {
+    printf("TRAC_POLICY kind %s memkind error: %d\n", name, err);
+    return false;
+  }
+  m_kinds.push_back(kind);
+  return true;
+}
+
+bool Policy::findKind(const char * name, size_t & index) const
+{
+  for (size_t idx = 0; idx < m_kinds.size(); ++idx) {
+    if (!strcmp(m_kinds[idx].name, name)) {
+      index = idx;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Policy::matchesStack(const Rule & rule, uint32_t stack) const
+{
+  if (!rule.lib) {
+    return true;
+  }
+  size_t count = 0;
+  const Mappings::LibAddr * frames = Stacks::resolved(stack, count);
+  for (size_t idx = 0; idx < count; ++idx) {
+    if (frames[idx].index == rule.lib && rule.offset.contains(frames[idx].offset)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+const Policy * Policy::get()
+{
+  pthread_once(&s_load, load);
+  return s_instance;
+}
+
+void Policy::end()
+{
+  if (!s_instance) {
+    return;
+  }
+  for (Kind & kind : s_instance->m_kinds) {
+    if (kind.created) {
+      memkind_destroy_kind(kind.kind);
+      kind.created = false;
+    }
+  }
+}
+
+uint32_t Policy::band(size_t size) const
+{
+  return std::upper_bound(m_bounds.begin(), m_bounds.end(), size) - m_bounds.begin();
+}
+
+void Policy::evaluate(size_t size, uint32_t stack, size_t thread, memkind_t & kind, PageMode & pages) const
+{
+  bool placed = false;
+  bool paged = false;
+  for (const Rule & rule : m_rules) {
+    if ((rule.pages? paged : placed) ||
+        !rule.size.contains(size) || !rule.thread.contains(thread) || !matchesStack(rule, stack)) {
+      continue;
+    }
+    if (rule.pages) {
+      pages = (PageMode)rule.kind;
+      paged = true;
+    } else {
+      kind = m_kinds[rule.kind].kind;
+      placed = true;
+    }
+    if (placed && paged) {
+      return;
+    }
+  }
+  if (!placed) {
+    kind = m_kinds[m_default].kind;
+  }
+  if (!paged) {
+    pages = DefaultPages;
+  }
+}
+
+} // namespace trac
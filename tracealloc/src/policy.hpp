@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <memkind.h>
+
+#include "arena.hpp"
+
+
+namespace trac
+{
+
+// Placement rules read from the file named by TRAC_POLICY, one per line:
+//   kind <name> <dir> [<size>]   creates a file-backed memkind in <dir>
+//   default <kind>               kind used when no rule matches
+//   place <kind> [size=<range>] [lib=<index>] [offset=<range>] [thread=<range>]
+//   pages <mode> [size=<range>] [lib=<index>] [offset=<range>] [thread=<range>]
+// Page modes are thp (madvise(MADV_HUGEPAGE)), hugetlb (memkind's hugetlb kind
+//   instead of dram), 4k (madvise(MADV_NOHUGEPAGE)) and default.
+// Ranges are <min>-<max>, <min>- or <value>, bounds are inclusive. lib and
+//   offset match any frame of the allocation's stack as resolved in stacks.log,
+//   thread matches the handler id of alloc_<id>_<tid>.trc. The first matching
+//   place and pages rules win. Predefined kinds are dram and pmem, the latter being the
+//   TRAC_PMEMDIR kind (or dram without TRAC_PMEMDIR).
+class Policy : public ArenaObject
+{
+public:
+  enum PageMode : uint8_t
+  {
+    DefaultPages,
+    TransparentHugePages,
+    HugetlbPages,
+    SmallPages,
+  };
+
+  // memoized result of evaluate() for one stack and size band
+  struct Decision
+  {
+    uint32_t stack;
+    uint32_t band;
+    memkind_t kind;
+    PageMode pages;
+  };
+
+  static constexpr size_t CacheSize = 256;
+
+private:
+  struct Range
+  {
+    uint64_t min;
+    uint64_t max;
+
+    bool contains(uint64_t value) const { return min <= value && value <= max; }
+  };
+
+  struct Kind
+  {
+    char name[32];
+    memkind_t kind; // nullptr for the TRAC_PMEMDIR kind
+    bool created;
+  };
+
+  struct Rule
+  {
+    bool pages;     // sets the page mode instead of the kind
+    size_t kind;    // or PageMode
+    Range size;
+    size_t lib;     // 0 matches any stack
+    Range offset;
+    Range thread;
+  };
+
+  static Policy * s_instance;
+  static pthread_once_t s_load;
+
+  ArenaVector<Kind> m_kinds;
+  ArenaVector<Rule> m_rules;
+  ArenaVector<uint64_t> m_bounds; // sorted first sizes of the size bands
+  size_t m_default;
+
+  Policy();
+
+  static void load();
+  bool parse(char * line);
+  bool parseCriteria(const char * const * args, size_t count, Rule & rule);
+  bool addKind(const char * name, const char * dir, const char * size);
+  bool findKind(const char * name, size_t & index) const;
+
+  bool matchesStack(const Rule & rule, uint32_t stack) const;
+
+public:
+  // the policy from TRAC_POLICY, nullptr if none is configured
+  static const Policy * get();
+  static void end();
+
+  // all sizes of a band satisfy the same size ranges, so decisions can be cached per band
+  uint32_t band(size_t size) const;
+  // kind nullptr selects the TRAC_PMEMDIR kind
+  void evaluate(size_t size, uint32_t stack, size_t thread, memkind_t & kind, PageMode & pages) const;
+};
+
+} // namespace trac
@@ -0,0 +1,275 @@
+#include "prefault.hpp"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "clock.hpp"
+#include "common.hpp"
+#include "numa.hpp"
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23 // Linux 5.14
+#endif
+
+
+namespace trac
+{
+
+pthread_once_t Prefault::s_init = PTHREAD_ONCE_INIT;
+bool Prefault::s_async = false;
+size_t Prefault::s_minSize = 0;
+size_t Prefault::s_threads = 4;
+bool Prefault::s_populate = true;
+pthread_mutex_t Prefault::s_guard = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t Prefault::s_work = PTHREAD_COND_INITIALIZER;
+pthread_cond_t Prefault::s_finished = PTHREAD_COND_INITIALIZER;
+Prefault::Job Prefault::s_jobs[Prefault::MaxJobs];
+std::atomic<size_t> Prefault::s_unlogged(0);
+
+static size_t pageSize()
+{
+  static const size_t size = sysconf(_SC_PAGESIZE);
+  return size;
+}
+
+void Prefault::init()
+{
+  const char * mode = getenv("TRAC_PREFAULT");
+  if (!mode) {
+    return;
+  }
+  if (strcmp(mode, "sync") && strcmp(mode, "async")) {
+    printf("TRAC_PREFAULT=%s is neither sync nor async, not prefaulting\n", mode);
+    return;
+  }
+  s_async = !strcmp(mode, "async");
+  size_t size = 64ul << 20;
+  const char * minsize = getenv("TRAC_PREFAULT_SIZE");
+  if (minsize && strtoul(minsize, nullptr, 0)) {
+    size = strtoul(minsize, nullptr, 0);
+  }
+  const char * threads = getenv("TRAC_PREFAULT_THREADS");
+  if (threads && strtoul(threads, nullptr, 0)) {
+    s_threads = strtoul(threads, nullptr, 0);
+    if (s_threads > MaxThreads) {
+      s_threads = MaxThreads;
+    }
+  }
+  size_t started = 0;
+  for (; started < s_threads; ++started) {
+    pthread_t helper;
+    int err = pthread_create(&helper, nullptr, &helperMain, nullptr);
+    if (err) {
+      printf("Prefault helper error: %d\n", err);
+      break;
+    }
+    pthread_detach(helper);
+  }
+  s_threads = started;
+  if (s_threads) {
+    s_minSize = size;
+  }
+}
+
+bool Prefault::enabled(size_t size)
+{
+  pthread_once(&s_init, init);
+  return s_minSize && size >= s_minSize;
+}
+
+bool Prefault::async()
+{
+  return s_async;
+}
+
+void Prefault::populate(uintptr_t begin, uintptr_t end)
+{
+  size_t page = pageSize();
+  if (s_populate) {
+    if (!madvise((void *)begin, end - begin, MADV_POPULATE_WRITE)) {
+      return;
+    }
+    if (errno != EINVAL) {
+      return; // e.g. out of memory, touching would not do better
+    }
+    s_populate = false; // not supported by the kernel
+  }
+  for (uintptr_t pos = begin; pos < end; pos += page) {
+    // write fault without losing a concurrent write of the application
+    __atomic_fetch_add((char *)pos, 0, __ATOMIC_RELAXED);
+  }
+}
+
+void Prefault::measure(Job & job) // called holding s_guard
+{
+  size_t page = pageSize();
+  size_t perNode[Numa::MaxNodes] = {0};
+  size_t sampled = Numa::sample(job.base, job.size / page, page, perNode);
+  job.result.node = -1;
+  job.result.share = 0;
+  for (int node = 0; node < Numa::MaxNodes; ++node) {
+    if (perNode[node] && (job.result.node < 0 || perNode[node] > perNode[job.result.node])) {
+      job.result.node = node;
+    }
+  }
+  if (job.result.node >= 0) {
+    job.result.share = perNode[job.result.node] * 100 / sampled;
+  }
+}
+
+void * Prefault::helperMain(void * arg)
+{
+  setInternalThread();
+  cpu_set_t all;
+  sched_getaffinity(0, sizeof(all), &all);
+  int pinned = -1;
+  pthread_mutex_lock(&s_guard);
+  for (;;) {
+    Job * job = nullptr;
+    for (Job & candidate : s_jobs) {
+      if (candidate.state == Running && candidate.started < candidate.chunks) {
+        job = &candidate;
+        break;
+      }
+    }
+    if (!job) {
+      pthread_cond_wait(&s_work, &s_guard);
+      continue;
+    }
+    size_t page = pageSize();
+    size_t chunk = job->started++;
+    size_t chunkSize = (job->size / job->chunks) & ~(page - 1);
+    uintptr_t begin = job->base + chunk * chunkSize;
+    uintptr_t end = (chunk + 1 == job->chunks)? job->base + job->size : begin + chunkSize;
+    int node = job->node;
+    pthread_mutex_unlock(&s_guard);
+
+    if (node != pinned) {
+      cpu_set_t cpus;
+      if (node < 0 || !Numa::cpus(node, cpus)) {
+        cpus = all;
+      }
+      sched_setaffinity(0, sizeof(cpus), &cpus);
+      pinned = node;
+    }
+    populate(begin, end);
+
+    pthread_mutex_lock(&s_guard);
+    if (++job->done == job->chunks) {
+      job->result.time = Clock::now();
+      job->result.ns = Clock::ns() - job->begin;
+      measure(*job);
+      if (!s_async) {
+        job->state = Finished;
+      } else if (job->logged) {
+        job->state = Finished;
+        s_unlogged.fetch_add(1, std::memory_order_release);
+      } else {
+        job->state = Free; // nobody collects it without a trace
+      }
+      pthread_cond_broadcast(&s_finished);
+    }
+  }
+  return nullptr;
+}
+
+bool Prefault::submit(void * ptr, size_t size, int node, uint32_t owner, bool logged, Result & result)
+{
+  // only whole pages can be populated
+  size_t page = pageSize();
+  uintptr_t begin = ((uintptr_t)ptr + page - 1) & ~(page - 1);
+  uintptr_t end = ((uintptr_t)ptr + size) & ~(page - 1);
+  if (begin >= end) {
+    return false;
+  }
+  pthread_mutex_lock(&s_guard);
+  Job * job = nullptr;
+  for (Job & candidate : s_jobs) {
+    if (candidate.state == Free) {
+      job = &candidate;
+      break;
+    }
+  }
+  if (!job) {
+    // too many pending prefaults, leave this one to first touch
+    pthread_mutex_unlock(&s_guard);
+    return false;
+  }
+  job->state = Running;
+  job->owner = owner;
+  job->logged = logged;
+  job->base = begin;
+  job->size = end - begin;
+  job->node = node;
+  job->chunks = (job->size / page < s_threads)? 1 : s_threads;
+  job->started = 0;
+  job->done = 0;
+  job->begin = Clock::ns();
+  job->result.base = (uintptr_t)ptr;
+  pthread_cond_broadcast(&s_work);
+  if (s_async) {
+    pthread_mutex_unlock(&s_guard);
+    return false;
+  }
+  while (job->state != Finished) {
+    pthread_cond_wait(&s_finished, &s_guard);
+  }
+  result = job->result;
+  job->state = Free;
+  pthread_mutex_unlock(&s_guard);
+  return true;
+}
+
+void Prefault::wait(uintptr_t base)
+{
+  pthread_mutex_lock(&s_guard);
+  for (Job & job : s_jobs) {
+    while (job.state == Running && job.result.base == base) {
+      pthread_cond_wait(&s_finished, &s_guard);
+    }
+  }
+  pthread_mutex_unlock(&s_guard);
+}
+
+bool Prefault::take(uint32_t owner, Result & result) // called holding s_guard
+{
+  for (Job & job : s_jobs) {
+    if (job.state == Finished && job.owner == owner) {
+      result = job.result;
+      job.state = Free;
+      s_unlogged.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Prefault::collect(uint32_t owner, Result & result, bool all)
+{
+  if (!all && !s_unlogged.load(std::memory_order_acquire)) {
+    return false;
+  }
+  pthread_mutex_lock(&s_guard);
+  bool found = take(owner, result);
+  while (!found && all) {
+    bool running = false;
+    for (Job & job : s_jobs) {
+      running |= job.state == Running && job.owner == owner;
+    }
+    if (!running) {
+      break;
+    }
+    pthread_cond_wait(&s_finished, &s_guard);
+    found = take(owner, result);
+  }
+  pthread_mutex_unlock(&s_guard);
+  return found;
+}
+
+} // namespace trac
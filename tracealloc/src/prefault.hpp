@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+
+namespace trac
+{
+
+// Populates the pages of traced allocations from TRAC_PREFAULT_SIZE bytes on
+//   (default 64 MiB) with TRAC_PREFAULT_THREADS helper threads (default 4),
+//   instead of leaving a serial page fault storm to the first touch.
+//   TRAC_PREFAULT=sync completes before the allocation is returned, async
+//   continues alongside the application.
+// Helpers are pinned to the cpus of the node the pages are meant for, so first
+//   touch places them there. Pages are populated with MADV_POPULATE_WRITE or,
+//   on older kernels, atomic no-op writes, so racing application writes are kept.
+class Prefault
+{
+public:
+  struct Result
+  {
+    uintptr_t base;
+    uint64_t time;   // when finished, from Clock::now()
+    uint64_t ns;     // duration
+    int node;        // node holding most sampled pages, -1 if unknown
+    uint8_t share;   // percentage of sampled pages on that node
+  };
+
+  static constexpr size_t MaxJobs = 64;
+  static constexpr size_t MaxThreads = 64;
+
+private:
+  enum State : uint8_t
+  {
+    Free,
+    Running,
+    Finished,
+  };
+
+  struct Job
+  {
+    State state;
+    uint32_t owner;
+    bool logged;     // async results are collected, else the job is freed when done
+    uintptr_t base;
+    size_t size;
+    int node;
+    size_t chunks;
+    size_t started;
+    size_t done;
+    uint64_t begin;
+    Result result;
+  };
+
+  static pthread_once_t s_init;
+  static bool s_async;
+  static size_t s_minSize;
+  static size_t s_threads;
+  static bool s_populate;
+  static pthread_mutex_t s_guard;
+  static pthread_cond_t s_work;
+  static pthread_cond_t s_finished;
+  static Job s_jobs[MaxJobs];
+  static std::atomic<size_t> s_unlogged; // finished async jobs not collected yet
+
+  static void init();
+  static void * helperMain(void * arg);
+  static void populate(uintptr_t begin, uintptr_t end);
+  static void measure(Job & job);
+  static bool take(uint32_t owner, Result & result);
+
+public:
+  // whether allocations of this size are prefaulted
+  static bool enabled(size_t size);
+  static bool async();
+
+  // node -1 leaves the helpers unpinned, returns true with result set if completed synchronously,
+  //   async results are only kept for collect if logged
+  static bool submit(void * ptr, size_t size, int node, uint32_t owner, bool logged, Result & result);
+  // must precede freeing or resizing a prefaulted allocation
+  static void wait(uintptr_t base);
+  // next finished prefault of owner, optionally waiting for those still running
+  static bool collect(uint32_t owner, Result & result, bool all = false);
+};
+
+} // namespace trac
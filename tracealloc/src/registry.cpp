@@ -0,0 +1,272 @@
+#include "registry.hpp"
+
+#include <sys/mman.h>
+
+#include "clock.hpp"
+#include "stats.hpp"
+
+
+namespace trac
+{
+
+Registry::Shard Registry::s_shards[Registry::ShardCount];
+pthread_once_t Registry::s_shardsInit = PTHREAD_ONCE_INIT;
+uint32_t * Registry::s_granules = nullptr;
+
+memkind_t Registry::s_kinds[Registry::MaxKinds] = { nullptr };
+std::atomic<uint32_t> Registry::s_kindCount(1);
+pthread_mutex_t Registry::s_kindsGuard = PTHREAD_MUTEX_INITIALIZER;
+
+void Registry::initShards()
+{
+  for (Shard & shard : s_shards) {
+    pthread_mutex_init(&shard.lock, nullptr);
+    shard.slots = nullptr;
+    shard.capacity = 0;
+    shard.used = 0;
+    shard.live = 0;
+  }
+  // untouched counters stay unbacked, MAP_FAILED makes owns() accept everything
+  void * granules = mmap(nullptr, GranuleCount * sizeof(uint32_t), PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  __atomic_store_n(&s_granules, (uint32_t *)granules, __ATOMIC_RELEASE);
+}
+
+uint64_t Registry::hash(uintptr_t base)
+{
+  // allocations are at least 16 byte aligned, so the low bits carry no information
+  uint64_t x = base >> 4;
+  x = (x ^ (x >> 33)) * 0xff51afd7ed558ccdull;
+  x = (x ^ (x >> 33)) * 0xc4ceb9fe1a85ec53ull;
+  return x ^ (x >> 33);
+}
+
+Registry::Shard & Registry::shardOf(uint64_t hash)
+{
+  pthread_once(&s_shardsInit, initShards);
+  return s_shards[hash >> (64 - ShardBits)];
+}
+
+uint32_t Registry::kindIndex(memkind_t kind)
+{
+  if (!kind) {
+    return 0;
+  }
+  uint32_t count = s_kindCount.load(std::memory_order_acquire);
+  for (uint32_t idx = 1; idx < count; ++idx) {
+    if (s_kinds[idx] == kind) {
+      return idx;
+    }
+  }
+  pthread_mutex_lock(&s_kindsGuard);
+  count = s_kindCount.load(std::memory_order_relaxed);
+  uint32_t idx = 1;
+  while (idx < count && s_kinds[idx] != kind) {
+    ++idx;
+  }
+  if (idx == count && count < MaxKinds) {
+    s_kinds[idx] = kind;
+    s_kindCount.store(count + 1, std::memory_order_release);
+  }
+  pthread_mutex_unlock(&s_kindsGuard);
+  return (idx < MaxKinds)? idx : 0;
+}
+
+void Registry::lock(Shard & shard)
+{
+  if (!pthread_mutex_trylock(&shard.lock)) {
+    return;
+  }
+  // contended, time the wait for TRAC_STATS
+  Stats::Local * local = Stats::local();
+  uint64_t start = local? Clock::ns() : 0;
+  pthread_mutex_lock(&shard.lock);
+  if (local) {
+    local->sections[Stats::RegistryWait].add(Clock::ns() - start);
+  }
+}
+
+Registry::Entry * Registry::find(Shard & shard, uint64_t hash, uintptr_t base)
+{
+  if (!shard.slots) {
+    return nullptr;
+  }
+  size_t mask = shard.capacity - 1;
+  for (size_t pos = hash & mask; ; pos = (pos + 1) & mask) {
+    Entry & entry = shard.slots[pos];
+    if (entry.base == base) {
+      return &entry;
+    } else if (entry.base == EmptySlot) {
+      return nullptr;
+    }
+  }
+}
+
+void Registry::grow(Shard & shard)
+{
+  size_t capacity = InitialCapacity;
+  while ((shard.live + 1) * 2 > capacity) {
+    capacity *= 2;
+  }
+  // mmap delivers zeroed memory, i.e. all slots EmptySlot
+  Entry * slots = (Entry *)mmap(nullptr, capacity * sizeof(Entry), PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (slots == MAP_FAILED) {
+    return;
+  }
+  size_t mask = capacity - 1;
+  for (size_t idx = 0; idx < shard.capacity; ++idx) {
+    Entry & entry = shard.slots[idx];
+    if (entry.base != EmptySlot && entry.base != RemovedSlot) {
+      size_t pos = hash(entry.base) & mask;
+      while (slots[pos].base != EmptySlot) {
+        pos = (pos + 1) & mask;
+      }
+      slots[pos] = entry;
+    }
+  }
+  if (shard.slots) {
+    munmap(shard.slots, shard.capacity * sizeof(Entry));
+  }
+  shard.slots = slots;
+  shard.capacity = capacity;
+  shard.used = shard.live;
+}
+
+void Registry::addGranule(uintptr_t base, int32_t delta)
+{
+  uintptr_t granule = base >> GranuleShift;
+  if (granule < GranuleCount && s_granules != (uint32_t *)MAP_FAILED) {
+    __atomic_fetch_add(&s_granules[granule], delta, __ATOMIC_RELAXED);
+  }
+}
+
+bool Registry::insert(uintptr_t base, const Alloc & info)
+{
+  uint64_t h = hash(base);
+  Shard & shard = shardOf(h);
+  uint32_t kind = kindIndex(info.kind);
+  if (info.kind && !kind) {
+    // no index left, the entry would send the free to glibc
+    return false;
+  }
+  bool success = false;
+  lock(shard);
+  if ((shard.used + 1) * 4 > shard.capacity * 3) {
+    grow(shard);
+  }
+  // with grow failing the table fills up, one empty slot has to stay to end probes
+  if (shard.slots && shard.used + 1 < shard.capacity) {
+    size_t mask = shard.capacity - 1;
+    size_t pos = h & mask;
+    Entry * slot = nullptr;
+    for (; shard.slots[pos].base != EmptySlot; pos = (pos + 1) & mask) {
+      if (shard.slots[pos].base == base) {
+        slot = &shard.slots[pos];
+        break;
+      } else if (!slot && shard.slots[pos].base == RemovedSlot) {
+        slot = &shard.slots[pos];
+      }
+    }
+    if (!slot) {
+      slot = &shard.slots[pos];
+      shard.used += 1;
+    }
+    if (slot->base != base) {
+      shard.live += 1;
+      addGranule(base, 1);
+    }
+    *slot = Entry{base, info.size, info.owner, kind, info.tag};
+    success = true;
+  }
+  pthread_mutex_unlock(&shard.lock);
+  return success;
+}
+
+bool Registry::lookup(uintptr_t base, Alloc & info)
+{
+  uint64_t h = hash(base);
+  Shard & shard = shardOf(h);
+  lock(shard);
+  Entry * entry = find(shard, h, base);
+  if (entry) {
+    info = Alloc{entry->size, s_kinds[entry->kind], entry->owner, entry->tag};
+  }
+  pthread_mutex_unlock(&shard.lock);
+  return entry != nullptr;
+}
+
+bool Registry::remove(uintptr_t base, Alloc & info)
+{
+  uint64_t h = hash(base);
+  Shard & shard = shardOf(h);
+  lock(shard);
+  Entry * entry = find(shard, h, base);
+  if (entry) {
+    info = Alloc{entry->size, s_kinds[entry->kind], entry->owner, entry->tag};
+    entry->base = RemovedSlot;
+    shard.live -= 1;
+    addGranule(base, -1);
+  }
+  pthread_mutex_unlock(&shard.lock);
+  return entry != nullptr;
+}
+
+bool Registry::tag(uintptr_t base, uint32_t tag, Alloc & info)
+{
+  uint64_t h = hash(base);
+  Shard & shard = shardOf(h);
+  lock(shard);
+  Entry * entry = find(shard, h, base);
+  if (entry) {
+    info = Alloc{entry->size, s_kinds[entry->kind], entry->owner, entry->tag};
+    entry->tag = tag;
+  }
+  pthread_mutex_unlock(&shard.lock);
+  return entry != nullptr;
+}
+
+void Registry::forEach(Visitor visitor, void * data)
+{
+  pthread_once(&s_shardsInit, initShards);
+  for (Shard & shard : s_shards) {
+    pthread_mutex_lock(&shard.lock);
+    for (size_t idx = 0; idx < shard.capacity; ++idx) {
+      Entry & entry = shard.slots[idx];
+      if (entry.base != EmptySlot && entry.base != RemovedSlot) {
+        visitor(entry.base, Alloc{entry.size, s_kinds[entry.kind], entry.owner, entry.tag}, data);
+      }
+    }
+    pthread_mutex_unlock(&shard.lock);
+  }
+}
+
+size_t Registry::walk(uint64_t & cursor, size_t count, Visitor visitor, void * data)
+{
+  pthread_once(&s_shardsInit, initShards);
+  // shard index in the upper, slot index in the lower half
+  size_t index = cursor >> 32;
+  size_t slot = cursor & 0xffffffffu;
+  size_t visited = 0;
+  for (; index < ShardCount; ++index, slot = 0) {
+    Shard & shard = s_shards[index];
+    pthread_mutex_lock(&shard.lock);
+    for (; slot < shard.capacity && visited < count; ++slot) {
+      Entry & entry = shard.slots[slot];
+      if (entry.base != EmptySlot && entry.base != RemovedSlot) {
+        visitor(entry.base, Alloc{entry.size, s_kinds[entry.kind], entry.owner, entry.tag}, data);
+        ++visited;
+      }
+    }
+    bool full = slot < shard.capacity;
+    pthread_mutex_unlock(&shard.lock);
+    if (full) {
+      cursor = ((uint64_t)index << 32) | slot;
+      return visited;
+    }
+  }
+  cursor = 0;
+  return visited;
+}
+
+} // namespace trac
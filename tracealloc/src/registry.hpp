@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <memkind.h>
+
+
+namespace trac
+{
+
+// Process-wide map from allocation base addresses to allocation info.
+// Entries live in independently locked shards of open addressing tables,
+// so lookups cost O(1) regardless of which thread created an allocation.
+// Only allocations served by memkind are registered. Per 2 MiB granule of
+//   the address space, a counter tracks how many registered bases lie in it,
+//   so owns() rejects the glibc heap's pointers with a single load.
+class Registry
+{
+public:
+  struct Alloc
+  {
+    size_t size;
+    memkind_t kind;
+    uint32_t owner;
+    uint32_t tag;   // Tags id, 0 if untagged
+  };
+
+  typedef void (*Visitor)(uintptr_t base, const Alloc & info, void * data);
+
+private:
+  struct Entry
+  {
+    uintptr_t base; // EmptySlot or RemovedSlot if unused
+    uint64_t size;
+    uint32_t owner;
+    uint32_t kind;  // index into s_kinds, 0 for allocations not served by memkind
+    uint32_t tag;
+  };
+
+  struct alignas(64) Shard
+  {
+    pthread_mutex_t lock;
+    Entry * slots;
+    size_t capacity;
+    size_t used;    // live and removed slots, bounds probe sequences
+    size_t live;
+  };
+
+  static constexpr uintptr_t EmptySlot = 0;
+  static constexpr uintptr_t RemovedSlot = 1;
+  static constexpr size_t ShardBits = 8;
+  static constexpr size_t ShardCount = 1ul << ShardBits;
+  static constexpr size_t InitialCapacity = 64;
+  static constexpr size_t MaxKinds = 256;
+  static constexpr size_t GranuleShift = 21;
+  static constexpr size_t AddressBits = 47;
+  static constexpr size_t GranuleCount = 1ul << (AddressBits - GranuleShift);
+
+  static Shard s_shards[ShardCount];
+  static pthread_once_t s_shardsInit;
+  static uint32_t * s_granules;
+
+  static memkind_t s_kinds[MaxKinds];
+  static std::atomic<uint32_t> s_kindCount;
+  static pthread_mutex_t s_kindsGuard;
+
+  static void initShards();
+  static uint64_t hash(uintptr_t base);
+  static Shard & shardOf(uint64_t hash);
+  static void lock(Shard & shard);
+  static uint32_t kindIndex(memkind_t kind);
+
+  static Entry * find(Shard & shard, uint64_t hash, uintptr_t base);
+  static void grow(Shard & shard);
+  static void addGranule(uintptr_t base, int32_t delta);
+
+public:
+  // false if the entry could not be stored, the allocation must then not be
+  //   handed out as traced
+  static bool insert(uintptr_t base, const Alloc & info);
+  static bool lookup(uintptr_t base, Alloc & info);
+  static bool remove(uintptr_t base, Alloc & info);
+  // names the allocation at base, info receives it with the previous tag
+  static bool tag(uintptr_t base, uint32_t tag, Alloc & info);
+
+  // false if base is certainly not registered
+  static inline bool owns(uintptr_t base)
+  {
+    uintptr_t granule = base >> GranuleShift;
+    uint32_t * granules = __atomic_load_n(&s_granules, __ATOMIC_ACQUIRE);
+    if (granule >= GranuleCount || granules == (uint32_t *)MAP_FAILED) {
+      return true;
+    }
+    return granules && __atomic_load_n(&granules[granule], __ATOMIC_RELAXED);
+  }
+
+  // Calls visitor for each entry while holding the respective shard lock,
+  //   so visitor must not call back into the Registry.
+  static void forEach(Visitor visitor, void * data);
+  // Like forEach, but visits up to count entries from cursor on and advances
+  //   cursor past them, so entries can be visited in chunks without copying
+  //   them all. cursor starts at 0 and returns to 0 after the last entry.
+  //   Entries moved by a growing shard meanwhile may be skipped or visited
+  //   twice. Returns the entries visited.
+  static size_t walk(uint64_t & cursor, size_t count, Visitor visitor, void * data);
+};
+
+} // namespace trac
@@ -0,0 +1,145 @@
+#include "residency.hpp"
+
+#include <algorithm>
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <new>
+
+#include "clock.hpp"
+#include "numa.hpp"
+
+
+namespace trac
+{
+
+pthread_once_t Residency::s_init = PTHREAD_ONCE_INIT;
+bool Residency::s_active = false;
+size_t Residency::s_allocs = 64;
+size_t Residency::s_pages = 1ul << 18;
+size_t Residency::s_page = 4096;
+int Residency::s_log = -1;
+Periodic Residency::s_sampler;
+ArenaVector<Residency::Range> * Residency::s_pending = nullptr;
+size_t Residency::s_next = 0;
+uint64_t Residency::s_cursor = 0;
+
+void Residency::init()
+{
+  const char * period = getenv("TRAC_RESIDENCY_PERIOD");
+  const char * logpath = getenv("TRAC_LOGPATH");
+  if (!period || !logpath || !strtoul(period, nullptr, 0)) {
+    return;
+  }
+  const char * allocs = getenv("TRAC_RESIDENCY_ALLOCS");
+  if (allocs && strtoul(allocs, nullptr, 0)) {
+    s_allocs = strtoul(allocs, nullptr, 0);
+  }
+  const char * pages = getenv("TRAC_RESIDENCY_PAGES");
+  if (pages && strtoul(pages, nullptr, 0)) {
+    s_pages = strtoul(pages, nullptr, 0);
+  }
+  s_page = sysconf(_SC_PAGESIZE);
+  char logfilename[256];
+  snprintf(logfilename, sizeof(logfilename), "%s/residency.log", logpath);
+  s_log = open(logfilename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  if (s_log < 0) {
+    printf("TRAC_RESIDENCY_PERIOD: can not open %s\n", logfilename);
+    return;
+  }
+  s_pending = new (Arena::allocate(sizeof(ArenaVector<Range>))) ArenaVector<Range>();
+  s_pending->reserve(s_allocs);
+  s_active = s_sampler.start(strtoul(period, nullptr, 0) * 1000000ull, &tick, false);
+  if (!s_active) {
+    printf("Residency sampler could not be started\n");
+  }
+}
+
+void Residency::begin()
+{
+  pthread_once(&s_init, init);
+}
+
+void Residency::end()
+{
+  if (!s_active) {
+    return;
+  }
+  s_sampler.stop();
+  s_active = false;
+  close(s_log);
+}
+
+void Residency::collect(uintptr_t base, const Registry::Alloc & info, void * data)
+{
+  s_pending->push_back(Range{base, info.size, 0, 0, false});
+}
+
+bool Residency::scan(Range & range, size_t & budget)
+{
+  uintptr_t first = range.base & ~(s_page - 1);
+  size_t pages = (range.base + range.size - first + s_page - 1) / s_page;
+  unsigned char vec[BatchSize];
+  while (range.scanned < pages && budget) {
+    size_t count = std::min(std::min(pages - range.scanned, BatchSize), budget);
+    if (mincore((void *)(first + range.scanned * s_page), count * s_page, vec)) {
+      range.released = true; // released meanwhile
+      return true;
+    }
+    for (size_t idx = 0; idx < count; ++idx) {
+      range.resident += vec[idx] & 1;
+    }
+    range.scanned += count;
+    budget -= count;
+  }
+  return range.scanned == pages;
+}
+
+int Residency::print(const Range & range, char * line, size_t length)
+{
+  if (range.released) {
+    return 0;
+  }
+  uintptr_t first = range.base & ~(s_page - 1);
+  int pos = snprintf(line, length, "%lx,%lu,%lu", range.base, range.resident, range.scanned);
+  if (range.resident) {
+    size_t perNode[Numa::MaxNodes] = {0};
+    Numa::sample(first, range.scanned, s_page, perNode);
+    for (int node = 0; node < Numa::MaxNodes; ++node) {
+      if (perNode[node]) {
+        pos += snprintf(line + pos, length - pos, ",%d:%lu", node, perNode[node]);
+      }
+    }
+  }
+  return pos + snprintf(line + pos, length - pos, "\n");
+}
+
+void Residency::tick()
+{
+  if (s_next == s_pending->size()) {
+    // taken in chunks, so the registry is neither copied nor held up by scanning
+    s_pending->clear();
+    s_next = 0;
+    Registry::walk(s_cursor, s_allocs, &collect, nullptr);
+  }
+
+  char buffer[1 << 14];
+  uint64_t now = Clock::ns();
+  size_t fill = snprintf(buffer, sizeof(buffer), "=%lu.%09lu\n", now / 1000000000ul, now % 1000000000ul);
+  size_t budget = s_pages;
+  while (s_next < s_pending->size() && scan((*s_pending)[s_next], budget)) {
+    fill += print((*s_pending)[s_next], buffer + fill, sizeof(buffer) - fill);
+    ++s_next;
+    if (sizeof(buffer) - fill < 1024) {
+      write(s_log, buffer, fill);
+      fill = 0;
+    }
+  }
+  write(s_log, buffer, fill);
+}
+
+} // namespace trac
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "arena.hpp"
+#include "periodic.hpp"
+#include "registry.hpp"
+
+
+namespace trac
+{
+
+// Timeline of how much of each registered allocation is resident and on which
+//   NUMA nodes. Every TRAC_RESIDENCY_PERIOD milliseconds, up to
+//   TRAC_RESIDENCY_PAGES pages (default 262144) of the next
+//   TRAC_RESIDENCY_ALLOCS allocations (default 64) in registry order are
+//   scanned, so all are visited in turn at bounded cost per tick. An
+//   allocation exceeding the pages left continues in the next tick. Residency
+//   comes from mincore, nodes from move_pages queries of up to
+//   Numa::SamplePages evenly spread pages.
+// Results go to residency.log in TRAC_LOGPATH, a tick being a line
+//   =<sec.nsec> (CLOCK_MONOTONIC_RAW) followed by
+//   <allocation>,<resident pages>,<pages>[,<node>:<sampled pages>]...
+//   for the allocations completed in it.
+class Residency
+{
+  struct Range
+  {
+    uintptr_t base;
+    size_t size;
+    size_t scanned;  // pages
+    size_t resident;
+    bool released;
+  };
+
+  static constexpr size_t BatchSize = 4096; // pages per mincore call
+
+  static pthread_once_t s_init;
+  static bool s_active;
+  static size_t s_allocs;
+  static size_t s_pages;
+  static size_t s_page;
+  static int s_log;
+  static Periodic s_sampler;
+  static ArenaVector<Range> * s_pending; // taken from the registry, not completed yet
+  static size_t s_next;                  // index of the first pending one
+  static uint64_t s_cursor;              // Registry::walk position
+
+  static void init();
+  static void collect(uintptr_t base, const Registry::Alloc & info, void * data);
+  static void tick();
+  static bool scan(Range & range, size_t & budget);
+  static int print(const Range & range, char * line, size_t length);
+
+public:
+  static void begin();
+  static void end();
+};
+
+} // namespace trac
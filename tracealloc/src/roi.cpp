@@ -0,0 +1,203 @@
+#include "roi.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tracealloc.h"
+#include "clock.hpp"
+#include "common.hpp"
+
+
+namespace trac
+{
+
+std::atomic<uint8_t> Roi::s_state(0);
+pthread_once_t Roi::s_init = PTHREAD_ONCE_INIT;
+bool Roi::s_scoped = false;
+bool Roi::s_triggered = false;
+std::atomic<bool> Roi::s_stop(false);
+int Roi::s_log = -1;
+int Roi::s_signal = SIGUSR2;
+size_t Roi::s_deadlineCount = 0;
+struct timespec Roi::s_deadlines[2];
+sem_t Roi::s_trigger;
+pthread_t Roi::s_thread;
+
+static void addSeconds(struct timespec & at, double seconds)
+{
+  uint64_t deadline = at.tv_nsec + (uint64_t)(seconds * 1000000000.0);
+  at.tv_sec += deadline / 1000000000ull;
+  at.tv_nsec = deadline % 1000000000ull;
+}
+
+void Roi::init()
+{
+  const char * logpath = getenv("TRAC_LOGPATH");
+  if (logpath) {
+    char logfilename[256];
+    snprintf(logfilename, sizeof(logfilename), "%s/roi.log", logpath);
+    s_log = open(logfilename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  }
+  const char * mode = getenv("TRAC_ROI");
+  if (!mode) {
+    return;
+  }
+  s_scoped = true;
+  s_state.store(Outside);
+  if (!strcmp(mode, "api")) {
+    return;
+  }
+  if (!strcmp(mode, "signal")) {
+    const char * signo = getenv("TRAC_ROI_SIGNAL");
+    if (signo && strtol(signo, nullptr, 0) > 0) {
+      s_signal = strtol(signo, nullptr, 0);
+    }
+  } else {
+    char * end = nullptr;
+    double from = strtod(mode, &end);
+    if (end == mode || from < 0.) {
+      printf("TRAC_ROI=%s is unknown, using api\n", mode);
+      return;
+    }
+    clock_gettime(CLOCK_REALTIME, &s_deadlines[0]);
+    s_deadlines[1] = s_deadlines[0];
+    addSeconds(s_deadlines[0], from);
+    s_deadlineCount = 1;
+    if (*end == ':') {
+      addSeconds(s_deadlines[1], strtod(end + 1, nullptr));
+      s_deadlineCount = 2;
+    }
+    s_signal = 0;
+  }
+  sem_init(&s_trigger, 0, 0);
+  if (s_signal) {
+    struct sigaction action = {};
+    action.sa_handler = &onSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(s_signal, &action, nullptr);
+  }
+  s_triggered = true;
+  int err = pthread_create(&s_thread, nullptr, &triggerMain, nullptr);
+  if (err) {
+    printf("ROI trigger error: %d\n", err);
+    s_triggered = false;
+  }
+}
+
+void Roi::begin()
+{
+  pthread_once(&s_init, init);
+}
+
+void Roi::end()
+{
+  if (s_triggered) {
+    s_stop.store(true);
+    sem_post(&s_trigger);
+    pthread_join(s_thread, nullptr);
+    s_triggered = false;
+  }
+  if (s_log >= 0) {
+    close(s_log);
+    s_log = -1;
+  }
+}
+
+void Roi::onSignal(int signo)
+{
+  // sem_post is async-signal-safe, toggling and logging happen on the trigger thread
+  sem_post(&s_trigger);
+}
+
+void * Roi::triggerMain(void * arg)
+{
+  setInternalThread();
+  size_t step = 0;
+  while (!s_stop.load()) {
+    int err = step < s_deadlineCount? sem_timedwait(&s_trigger, &s_deadlines[step]) : sem_wait(&s_trigger);
+    if (s_stop.load()) {
+      break;
+    }
+    if (err && errno != ETIMEDOUT) {
+      continue; // interrupted
+    }
+    if (err) {
+      ++step;
+    }
+    if (s_state.load() & Outside) {
+      enter(err? "timer" : "signal");
+    } else {
+      leave();
+    }
+  }
+  return nullptr;
+}
+
+void Roi::log(const char * event, const char * name)
+{
+  if (s_log < 0) {
+    return;
+  }
+  char line[256];
+  uint64_t now = Clock::ns();
+  int length = name?
+      snprintf(line, sizeof(line), "%lu.%09lu: %s: %.192s\n", now / 1000000000ul, now % 1000000000ul, event, name) :
+      snprintf(line, sizeof(line), "%lu.%09lu: %s\n", now / 1000000000ul, now % 1000000000ul, event);
+  write(s_log, line, length);
+}
+
+void Roi::enter(const char * name)
+{
+  log("begin", name? name : "");
+  if (s_scoped) {
+    s_state.fetch_and(~Outside);
+  }
+}
+
+void Roi::leave()
+{
+  if (s_scoped) {
+    s_state.fetch_or(Outside);
+  }
+  log("end");
+}
+
+void Roi::pause()
+{
+  s_state.fetch_or(Paused);
+  log("pause");
+}
+
+void Roi::resume()
+{
+  log("resume");
+  s_state.fetch_and(~Paused);
+}
+
+} // namespace trac
+
+void trac_roi_begin(const char * name)
+{
+  trac::Roi::enter(name);
+}
+
+void trac_roi_end(void)
+{
+  trac::Roi::leave();
+}
+
+void trac_pause(void)
+{
+  trac::Roi::pause();
+}
+
+void trac_resume(void)
+{
+  trac::Roi::resume();
+}
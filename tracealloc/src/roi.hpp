@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+
+
+namespace trac
+{
+
+// Regions of interest scoping which allocations are traced (see tracealloc.h).
+// TRAC_ROI selects how regions are entered:
+//   api            only by trac_roi_begin/trac_roi_end
+//   signal         also by each TRAC_ROI_SIGNAL (default SIGUSR2), toggling
+//   <from>[:<to>]  also in the window of that many seconds after startup
+// Without TRAC_ROI, regions are only logged. Pausing applies either way.
+// Boundaries go to roi.log in TRAC_LOGPATH, one per line:
+//   <sec.nsec>: <begin|end|pause|resume>[: <name>]
+//   with the CLOCK_MONOTONIC_RAW time of the decoded allocation traces.
+class Roi
+{
+  enum : uint8_t
+  {
+    Outside = 0x01,
+    Paused = 0x02,
+  };
+
+  static std::atomic<uint8_t> s_state;
+  static pthread_once_t s_init;
+  static bool s_scoped; // TRAC_ROI given
+  static bool s_triggered;
+  static std::atomic<bool> s_stop;
+  static int s_log;
+  static int s_signal;
+  static size_t s_deadlineCount;
+  static struct timespec s_deadlines[2]; // CLOCK_REALTIME for sem_timedwait
+  static sem_t s_trigger;
+  static pthread_t s_thread;
+
+  static void init();
+  static void onSignal(int signo);
+  static void * triggerMain(void * arg);
+  static void log(const char * event, const char * name = nullptr);
+
+public:
+  static void begin();
+  static void end();
+
+  // single relaxed load on every allocation
+  static inline bool traced() { return !s_state.load(std::memory_order_relaxed); }
+
+  static void enter(const char * name);
+  static void leave();
+  static void pause();
+  static void resume();
+};
+
+} // namespace trac
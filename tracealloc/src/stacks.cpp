@@ -0,0 +1,290 @@
+#include "stacks.hpp"
+
+#include <alloca.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <execinfo.h>
+#ifdef TRAC_HAVE_UNWIND
+#define UNW_LOCAL_ONLY
+#include <libunwind.h>
+#endif
+
+
+namespace trac
+{
+
+#ifdef TRAC_HAVE_UNWIND
+Stacks::Unwinder Stacks::s_unwinder = Stacks::Libunwind;
+#else
+Stacks::Unwinder Stacks::s_unwinder = Stacks::Backtrace;
+#endif
+Stacks::Shard Stacks::s_shards[Stacks::ShardCount];
+Stacks::Stack ** Stacks::s_byId = nullptr;
+uint32_t Stacks::s_count = 0;
+pthread_once_t Stacks::s_init = PTHREAD_ONCE_INIT;
+
+pthread_mutex_t Stacks::s_storeGuard = PTHREAD_MUTEX_INITIALIZER;
+char * Stacks::s_chunkPos = nullptr;
+char * Stacks::s_chunkEnd = nullptr;
+
+int Stacks::s_log = -1;
+
+void Stacks::init()
+{
+  const char * unwinder = getenv("TRAC_UNWIND");
+  if (unwinder) {
+    if (!strcmp(unwinder, "fp")) {
+      s_unwinder = FramePointer;
+    } else if (!strcmp(unwinder, "unwind")) {
+#ifdef TRAC_HAVE_UNWIND
+      s_unwinder = Libunwind;
+#endif
+    } else if (!strcmp(unwinder, "backtrace")) {
+      s_unwinder = Backtrace;
+    }
+  }
+  for (Shard & shard : s_shards) {
+    pthread_mutex_init(&shard.lock, nullptr);
+    shard.slots = nullptr;
+    shard.capacity = 0;
+    shard.used = 0;
+  }
+  void * index = mmap(nullptr, MaxStacks * sizeof(Stack *), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  s_byId = (index != MAP_FAILED)? (Stack **)index : nullptr;
+  const char * logpath = getenv("TRAC_LOGPATH");
+  if (logpath) {
+    char logfilename[256];
+    snprintf(logfilename, sizeof(logfilename), "%s/stacks.log", logpath);
+    s_log = open(logfilename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  }
+}
+
+uint64_t Stacks::hash(const uintptr_t * frames, size_t count)
+{
+  uint64_t x = count;
+  for (size_t idx = 0; idx < count; ++idx) {
+    x = (x ^ frames[idx]) * 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+  }
+  return x * 0xc4ceb9fe1a85ec53ull;
+}
+
+void * Stacks::store(size_t size) // must be called holding s_storeGuard
+{
+  size = (size + 15) & ~15ul;
+  if (s_chunkPos + size > s_chunkEnd) {
+    size_t chunk = (size > ChunkSize)? size : ChunkSize;
+    void * mem = mmap(nullptr, chunk, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+      return nullptr;
+    }
+    s_chunkPos = (char *)mem;
+    s_chunkEnd = s_chunkPos + chunk;
+  }
+  void * res = s_chunkPos;
+  s_chunkPos += size;
+  return res;
+}
+
+void Stacks::grow(Shard & shard)
+{
+  size_t capacity = shard.capacity? shard.capacity * 2 : InitialCapacity;
+  Stack ** slots = (Stack **)mmap(nullptr, capacity * sizeof(Stack *), PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (slots == MAP_FAILED) {
+    return;
+  }
+  size_t mask = capacity - 1;
+  for (size_t idx = 0; idx < shard.capacity; ++idx) {
+    Stack * stack = shard.slots[idx];
+    if (stack) {
+      size_t pos = stack->hash & mask;
+      while (slots[pos]) {
+        pos = (pos + 1) & mask;
+      }
+      slots[pos] = stack;
+    }
+  }
+  if (shard.slots) {
+    munmap(shard.slots, shard.capacity * sizeof(Stack *));
+  }
+  shard.slots = slots;
+  shard.capacity = capacity;
+}
+
+Stacks::Stack * Stacks::create(uint64_t hash, const uintptr_t * frames, size_t count)
+{
+  pthread_mutex_lock(&s_storeGuard);
+  Stack * stack = nullptr;
+  if (s_byId && s_count + 1 < MaxStacks) {
+    stack = (Stack *)store(sizeof(Stack) + count * (sizeof(uintptr_t) + sizeof(Mappings::LibAddr)));
+  }
+  if (stack) {
+    stack->hash = hash;
+    stack->id = ++s_count;
+    stack->count = count;
+    stack->frames = (uintptr_t *)(stack + 1);
+    stack->resolved = (Mappings::LibAddr *)(stack->frames + count);
+  }
+  pthread_mutex_unlock(&s_storeGuard);
+  if (stack) {
+    memcpy(stack->frames, frames, count * sizeof(uintptr_t));
+    for (size_t idx = 0; idx < count; ++idx) {
+      Mappings::lookup(frames[idx], stack->resolved[idx]);
+    }
+    __atomic_store_n(&s_byId[stack->id], stack, __ATOMIC_RELEASE);
+  }
+  return stack;
+}
+
+void Stacks::emit(const Stack & stack)
+{
+  if (s_log < 0) {
+    return;
+  }
+  char line[4096];
+  size_t len = snprintf(line, sizeof(line), "%u", stack.id);
+  for (size_t idx = 0; idx < stack.count && len + 40 < sizeof(line); ++idx) {
+    len += snprintf(line + len, sizeof(line) - len, ",%ld+%lx", stack.resolved[idx].index, stack.resolved[idx].offset);
+  }
+  line[len++] = '\n';
+  // a single append is atomic with respect to other threads emitting stacks
+  if (write(s_log, line, len) < 0) {
+    return;
+  }
+}
+
+__attribute__((noinline))
+size_t Stacks::walkFrames(uintptr_t * buf, size_t capacity, size_t skip, uintptr_t low, uintptr_t high)
+{
+  // relies on all frames between here and the caller maintaining frame pointers,
+  //   which is why the library is built with -fno-omit-frame-pointer
+  uintptr_t * frame = (uintptr_t *)__builtin_frame_address(0);
+  if ((uintptr_t)frame < low || (uintptr_t)frame >= high) {
+    // e.g. running on an alternate signal stack
+    return 0;
+  }
+  size_t count = 0;
+  skip += 1; // walkFrames itself
+  while (count < capacity) {
+    uintptr_t * next = (uintptr_t *)frame[0];
+    if ((uintptr_t)next <= (uintptr_t)frame || (uintptr_t)next + 3 * sizeof(uintptr_t) > high ||
+        ((uintptr_t)next & (sizeof(uintptr_t) - 1))) {
+      break;
+    }
+#if defined(__powerpc64__)
+    uintptr_t ret = next[2]; // ABI mandated back chain, LR save word in the caller's frame
+#elif defined(__x86_64__) || defined(__aarch64__)
+    uintptr_t ret = frame[1];
+#else
+    uintptr_t ret = 0;
+#endif
+    if (!ret) {
+      break;
+    }
+    if (skip) {
+      --skip;
+    } else {
+      buf[count++] = ret;
+    }
+    frame = next;
+  }
+  return count;
+}
+
+__attribute__((noinline))
+size_t Stacks::capture(uintptr_t * buf, size_t capacity, size_t skip, uintptr_t low, uintptr_t high)
+{
+  pthread_once(&s_init, init);
+  if (s_unwinder == FramePointer) {
+    size_t count = walkFrames(buf, capacity, skip, low, high);
+    if (count) {
+      return count;
+    }
+  }
+  // other unwinders report capture itself as the innermost frame
+  skip += 1;
+  void ** raw = (void **)alloca((capacity + skip) * sizeof(void *));
+  int levels = 0;
+#ifdef TRAC_HAVE_UNWIND
+  if (s_unwinder != Backtrace) {
+    levels = unw_backtrace(raw, capacity + skip);
+  } else
+#endif
+  {
+    levels = backtrace(raw, capacity + skip);
+  }
+  size_t count = 0;
+  for (int idx = skip; idx < levels; ++idx) {
+    buf[count++] = (uintptr_t)raw[idx];
+  }
+  return count;
+}
+
+uint32_t Stacks::intern(const uintptr_t * frames, size_t count)
+{
+  if (!count) {
+    return 0;
+  }
+  pthread_once(&s_init, init);
+  uint64_t h = hash(frames, count);
+  Shard & shard = s_shards[h >> (64 - ShardBits)];
+  Stack * created = nullptr;
+  uint32_t id = 0;
+  pthread_mutex_lock(&shard.lock);
+  if ((shard.used + 1) * 4 > shard.capacity * 3) {
+    grow(shard);
+  }
+  if (shard.slots && shard.used < shard.capacity) {
+    size_t mask = shard.capacity - 1;
+    size_t pos = h & mask;
+    for (; shard.slots[pos]; pos = (pos + 1) & mask) {
+      Stack * stack = shard.slots[pos];
+      if (stack->hash == h && stack->count == count &&
+          !memcmp(stack->frames, frames, count * sizeof(uintptr_t))) {
+        id = stack->id;
+        break;
+      }
+    }
+    if (!id) {
+      created = create(h, frames, count);
+      if (created) {
+        shard.slots[pos] = created;
+        shard.used += 1;
+        id = created->id;
+      }
+    }
+  }
+  pthread_mutex_unlock(&shard.lock);
+  if (created) {
+    emit(*created);
+  }
+  return id;
+}
+
+const Mappings::LibAddr * Stacks::resolved(uint32_t id, size_t & count)
+{
+  Stack * stack = (s_byId && id && id < MaxStacks)? __atomic_load_n(&s_byId[id], __ATOMIC_ACQUIRE) : nullptr;
+  if (!stack) {
+    count = 0;
+    return nullptr;
+  }
+  count = stack->count;
+  return stack->resolved;
+}
+
+void Stacks::end()
+{
+  if (s_log >= 0) {
+    close(s_log);
+    s_log = -1;
+  }
+}
+
+} // namespace trac
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "mappings.hpp"
+
+
+namespace trac
+{
+
+// Captures call stacks and deduplicates them into a process-wide table.
+// Each distinct sequence of return addresses receives a 32 bit id (0 means
+//   no stack) and is resolved through Mappings once, when it is first seen.
+//   Resolved stacks are written to stacks.log as "<id>,<index>+<offset>,...".
+// TRAC_UNWIND selects the unwinder: fp walks frame pointers, unwind uses
+//   libunwind (if available at build time) and backtrace glibc's backtrace().
+//   The frame pointer walk falls back to the others if it finds no frames.
+class Stacks
+{
+public:
+  enum Unwinder
+  {
+    FramePointer,
+    Libunwind,
+    Backtrace,
+  };
+
+private:
+  struct Stack
+  {
+    uint64_t hash;
+    uint32_t id;
+    uint32_t count;
+    uintptr_t * frames;
+    Mappings::LibAddr * resolved;
+  };
+
+  struct alignas(64) Shard
+  {
+    pthread_mutex_t lock;
+    Stack ** slots;
+    size_t capacity;
+    size_t used;
+  };
+
+  static constexpr size_t ShardBits = 6;
+  static constexpr size_t ShardCount = 1ul << ShardBits;
+  static constexpr size_t InitialCapacity = 64;
+  static constexpr size_t MaxStacks = 1ul << 24;
+  static constexpr size_t ChunkSize = 1ul << 20;
+
+  static Unwinder s_unwinder;
+  static Shard s_shards[ShardCount];
+  static Stack ** s_byId;
+  static uint32_t s_count;
+  static pthread_once_t s_init;
+
+  static pthread_mutex_t s_storeGuard;
+  static char * s_chunkPos;
+  static char * s_chunkEnd;
+
+  static int s_log;
+
+  static void init();
+  static uint64_t hash(const uintptr_t * frames, size_t count);
+  static void * store(size_t size);
+  static void grow(Shard & shard);
+  static Stack * create(uint64_t hash, const uintptr_t * frames, size_t count);
+  static void emit(const Stack & stack);
+
+  static size_t walkFrames(uintptr_t * buf, size_t capacity, size_t skip, uintptr_t low, uintptr_t high);
+
+public:
+  // Returns the return addresses of the calling function's callers,
+  //   low and high bound the calling thread's stack for the frame pointer walk
+  static size_t capture(uintptr_t * buf, size_t capacity, size_t skip, uintptr_t low, uintptr_t high);
+
+  static uint32_t intern(const uintptr_t * frames, size_t count);
+  static const Mappings::LibAddr * resolved(uint32_t id, size_t & count);
+
+  static void end();
+};
+
+} // namespace trac
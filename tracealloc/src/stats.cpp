@@ -0,0 +1,141 @@
+#include "stats.hpp"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+namespace trac
+{
+
+bool Stats::s_enabled = false;
+pthread_mutex_t Stats::s_guard = PTHREAD_MUTEX_INITIALIZER;
+Stats::Local * Stats::s_total = nullptr;
+thread_local Stats::Local * Stats::t_local = nullptr;
+
+static const char * const g_entryNames[] = {"malloc", "calloc", "memalign", "realloc", "free", "getsize", "mmap", "munmap", "mremap", "brk"};
+static const char * const g_pathNames[] = {"untraced", "dram", "mapped", "pmem"};
+static const char * const g_sectionNames[] = {"stack", "log", "registry_wait"};
+
+void Stats::Histogram::merge(const Histogram & other)
+{
+  count += other.count;
+  ns += other.ns;
+  for (size_t idx = 0; idx < BucketCount; ++idx) {
+    buckets[idx] += other.buckets[idx];
+  }
+}
+
+void Stats::Local::merge(const Local & other)
+{
+  for (size_t entry = 0; entry < EntryCount; ++entry) {
+    for (size_t path = 0; path < PathCount; ++path) {
+      entries[entry][path].merge(other.entries[entry][path]);
+    }
+  }
+  for (size_t section = 0; section < SectionCount; ++section) {
+    sections[section].merge(other.sections[section]);
+  }
+  traceBytes += other.traceBytes;
+  traceDropped += other.traceDropped;
+  handlers += other.handlers;
+}
+
+void Stats::begin()
+{
+  const char * stats = getenv("TRAC_STATS");
+  s_enabled = stats && strcmp(stats, "0");
+}
+
+Stats::Local * Stats::create()
+{
+  if (!s_enabled) {
+    return nullptr;
+  }
+  Local * local = (Local *)Arena::allocate(sizeof(Local));
+  memset(local, 0, sizeof(Local));
+  local->handlers = 1;
+  return local;
+}
+
+void Stats::merge(const Local * local)
+{
+  if (!local) {
+    return;
+  }
+  pthread_mutex_lock(&s_guard);
+  if (!s_total) {
+    s_total = create();
+    s_total->handlers = 0;
+  }
+  s_total->merge(*local);
+  pthread_mutex_unlock(&s_guard);
+}
+
+void Stats::retire(Local * local)
+{
+  if (!local) {
+    return;
+  }
+  merge(local);
+  if (t_local == local) {
+    t_local = nullptr;
+  }
+  Arena::deallocate(local, sizeof(Local));
+}
+
+static size_t printHistogram(char * buffer, size_t length, const Stats::Histogram & histogram)
+{
+  // trailing empty buckets are left out
+  size_t last = Stats::BucketCount;
+  while (last && !histogram.buckets[last - 1]) {
+    --last;
+  }
+  size_t fill = snprintf(buffer, length, "{\"count\": %lu, \"ns\": %lu, \"buckets\": [", histogram.count, histogram.ns);
+  for (size_t idx = 0; idx < last; ++idx) {
+    fill += snprintf(buffer + fill, length - fill, idx? ", %lu" : "%lu", histogram.buckets[idx]);
+  }
+  return fill + snprintf(buffer + fill, length - fill, "]}");
+}
+
+void Stats::end()
+{
+  const char * logpath = getenv("TRAC_LOGPATH");
+  if (!s_total || !logpath) {
+    return;
+  }
+  char logfilename[256];
+  snprintf(logfilename, sizeof(logfilename), "%s/stats.json", logpath);
+  int fd = open(logfilename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    printf("TRAC_STATS: can not open %s\n", logfilename);
+    return;
+  }
+  // each histogram takes at most BucketCount * 22 bytes
+  char buffer[1 << 16];
+  const Local & total = *s_total;
+  size_t fill = snprintf(buffer, sizeof(buffer), "{\n  \"handlers\": %lu,\n  \"trace_bytes\": %lu,\n  \"trace_dropped\": %lu,\n  \"entries\": {",
+                         total.handlers, total.traceBytes, total.traceDropped);
+  for (size_t entry = 0; entry < EntryCount; ++entry) {
+    fill += snprintf(buffer + fill, sizeof(buffer) - fill, "%s\n    \"%s\": {", entry? "," : "", g_entryNames[entry]);
+    for (size_t path = 0; path < PathCount; ++path) {
+      fill += snprintf(buffer + fill, sizeof(buffer) - fill, "%s\n      \"%s\": ", path? "," : "", g_pathNames[path]);
+      fill += printHistogram(buffer + fill, sizeof(buffer) - fill, total.entries[entry][path]);
+    }
+    fill += snprintf(buffer + fill, sizeof(buffer) - fill, "\n    }");
+    write(fd, buffer, fill);
+    fill = 0;
+  }
+  fill += snprintf(buffer + fill, sizeof(buffer) - fill, "\n  },\n  \"sections\": {");
+  for (size_t section = 0; section < SectionCount; ++section) {
+    fill += snprintf(buffer + fill, sizeof(buffer) - fill, "%s\n    \"%s\": ", section? "," : "", g_sectionNames[section]);
+    fill += printHistogram(buffer + fill, sizeof(buffer) - fill, total.sections[section]);
+  }
+  fill += snprintf(buffer + fill, sizeof(buffer) - fill, "\n  }\n}\n");
+  write(fd, buffer, fill);
+  close(fd);
+}
+
+} // namespace trac
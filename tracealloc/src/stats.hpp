@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "arena.hpp"
+#include "clock.hpp"
+
+
+namespace trac
+{
+
+// Self-instrumentation of the interposer's hot path, enabled by TRAC_STATS.
+// Each Handler counts calls and log2 bucketed latencies of its entry points,
+//   split by untraced and the backing of traced allocations, and of the
+//   sections capturing stacks, logging and waiting for Registry locks. Only
+//   the owning thread writes its counters, which are merged when the thread
+//   exits and at TRAC_END into stats.json in TRAC_LOGPATH. Bucket i of a
+//   histogram counts latencies of [2^(i-1), 2^i) nanoseconds.
+class Stats
+{
+public:
+  enum Entry : uint8_t
+  {
+    Malloc,
+    Calloc,
+    Memalign,
+    Realloc,
+    Free,
+    Getsize,
+    Mmap,
+    Munmap,
+    Mremap,
+    Brk,
+    EntryCount,
+  };
+
+  enum Path : uint8_t
+  {
+    Untraced,
+    Dram,     // memkind dram kinds
+    Mapped,   // DirectMap above TRAC_MMAP_THRESHOLD and regions of TRAC_MAPS
+    Pmem,     // file backed kinds
+    PathCount,
+  };
+
+  enum Section : uint8_t
+  {
+    StackSection,
+    LogSection,
+    RegistryWait, // only contended locks are timed
+    SectionCount,
+  };
+
+  static constexpr size_t BucketCount = 40;
+
+  struct Histogram
+  {
+    uint64_t count;
+    uint64_t ns;
+    uint64_t buckets[BucketCount];
+
+    inline void add(uint64_t value)
+    {
+      size_t bucket = value? 64 - __builtin_clzll(value) : 0;
+      ++count;
+      ns += value;
+      ++buckets[bucket < BucketCount? bucket : BucketCount - 1];
+    }
+
+    void merge(const Histogram & other);
+  };
+
+  struct Local
+  {
+    Histogram entries[EntryCount][PathCount];
+    Histogram sections[SectionCount];
+    uint64_t traceBytes;
+    uint64_t traceDropped;
+    uint64_t handlers;
+
+    void merge(const Local & other);
+  };
+
+  // times the enclosing scope into histogram, if not nullptr
+  class Timer
+  {
+    Histogram * m_histogram;
+    uint64_t m_start;
+
+  public:
+    inline Timer(Histogram * histogram) : m_histogram(histogram), m_start(histogram? Clock::ns() : 0) { }
+    inline ~Timer() { if (m_histogram) m_histogram->add(Clock::ns() - m_start); }
+  };
+
+  // times the enclosing scope into the histogram of the path taken by then
+  class EntryTimer
+  {
+    Histogram * m_paths;
+    const uint8_t & m_path;
+    uint64_t m_start;
+
+  public:
+    inline EntryTimer(Local * local, Entry entry, const uint8_t & path)
+    : m_paths(local? local->entries[entry] : nullptr), m_path(path), m_start(local? Clock::ns() : 0) { }
+    inline ~EntryTimer() { if (m_paths) m_paths[m_path].add(Clock::ns() - m_start); }
+  };
+
+private:
+  static bool s_enabled;
+  static pthread_mutex_t s_guard;
+  static Local * s_total;
+  static thread_local Local * t_local;
+
+public:
+  static void begin();
+  static void end();
+
+  static bool enabled() { return s_enabled; }
+
+  static Local * create();
+  // adds the counters of a handler to the totals
+  static void merge(const Local * local);
+  // merges and destroys the counters of a handler, called by its own thread
+  static void retire(Local * local);
+  // counters of the calling thread's handler, for code outside of it
+  static void setLocal(Local * local) { t_local = local; }
+  static inline Local * local() { return t_local; }
+};
+
+} // namespace trac
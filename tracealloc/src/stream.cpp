@@ -0,0 +1,222 @@
+#include "stream.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.hpp"
+
+
+namespace trac
+{
+
+StreamTrace * StreamTrace::s_first = nullptr;
+pthread_mutex_t StreamTrace::s_guard = PTHREAD_MUTEX_INITIALIZER;
+pthread_once_t StreamTrace::s_flusherInit = PTHREAD_ONCE_INIT;
+pthread_t StreamTrace::s_flusher;
+size_t StreamTrace::s_queueSize = StreamTrace::DefaultQueueSize;
+bool StreamTrace::s_block = true;
+
+void StreamTrace::initFlusher()
+{
+  const char * queuesize = getenv("TRAC_QUEUESIZE");
+  if (queuesize) {
+    size_t size = strtoul(queuesize, nullptr, 0);
+    if (size) {
+      // round up to a power of two for cheap index wrapping
+      s_queueSize = 1ul << (64 - __builtin_clzl((size - 1) | 1));
+    }
+  }
+  const char * backpressure = getenv("TRAC_BACKPRESSURE");
+  s_block = !backpressure || strcmp(backpressure, "drop") != 0;
+  int err = pthread_create(&s_flusher, nullptr, &flusherMain, nullptr);
+  if (err) {
+    printf("Trace flusher error: %d\n", err);
+  }
+}
+
+void * StreamTrace::flusherMain(void * arg)
+{
+  setInternalThread();
+  const struct timespec idle = {0, 1000000};
+  for (;;) {
+    bool busy = false;
+    pthread_mutex_lock(&s_guard);
+    for (StreamTrace * trace = s_first; trace; trace = trace->m_next) {
+      busy |= trace->drain();
+    }
+    pthread_mutex_unlock(&s_guard);
+    if (!busy) {
+      nanosleep(&idle, nullptr);
+    }
+  }
+  return nullptr;
+}
+
+StreamTrace::StreamTrace()
+: m_head(0)
+, m_dropped(0)
+, m_queuedDrops(0)
+, m_dropping(false)
+, m_tail(0)
+, m_prevTime(0)
+, m_prevBase(0)
+, m_buffer(nullptr)
+, m_fill(0)
+, m_fd(-1)
+, m_queue(nullptr)
+, m_next(nullptr)
+{ }
+
+StreamTrace::~StreamTrace()
+{
+  close();
+}
+
+bool StreamTrace::open(const char * path, uint64_t id, uint64_t tid)
+{
+  pthread_once(&s_flusherInit, initFlusher);
+  void * queue = mmap(nullptr, s_queueSize * sizeof(Record) + BufferSize, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (queue == MAP_FAILED) {
+    return false;
+  }
+  m_queue = (Record *)queue;
+  m_buffer = (uint8_t *)queue + s_queueSize * sizeof(Record);
+  m_fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (m_fd < 0) {
+    close();
+    return false;
+  }
+  TraceHeader header;
+  initHeader(header, id, tid, DeltaEncoding);
+  memcpy(m_buffer, &header, sizeof(header));
+  m_fill = sizeof(header);
+  flush();
+
+  pthread_mutex_lock(&s_guard);
+  m_next = s_first;
+  s_first = this;
+  pthread_mutex_unlock(&s_guard);
+  return true;
+}
+
+void StreamTrace::close()
+{
+  if (m_fd >= 0) {
+    pthread_mutex_lock(&s_guard);
+    drain();
+    // drops after the last Record kept
+    uint64_t dropped = m_dropped.load(std::memory_order_relaxed);
+    if (dropped != m_queuedDrops) {
+      encode(Record{DropInfo, 0, 0, 0, 0, dropped - m_queuedDrops});
+      m_queuedDrops = dropped;
+      flush();
+    }
+    for (StreamTrace ** link = &s_first; *link; link = &(*link)->m_next) {
+      if (*link == this) {
+        *link = m_next;
+        break;
+      }
+    }
+    pthread_mutex_unlock(&s_guard);
+    ::close(m_fd);
+    m_fd = -1;
+  }
+  if (m_queue) {
+    munmap(m_queue, s_queueSize * sizeof(Record) + BufferSize);
+    m_queue = nullptr;
+    m_buffer = nullptr;
+  }
+}
+
+void StreamTrace::put(const Record & rec)
+{
+  if (isInfo(rec.type) && m_dropping) {
+    // weight, node and mapping of a dropped event are meaningless on their own
+    m_dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  size_t head = m_head.load(std::memory_order_relaxed);
+  // after dropping, a DropInfo Record goes ahead of this one
+  size_t needed = m_dropping? 2 : 1;
+  while (head + needed - m_tail.load(std::memory_order_acquire) > s_queueSize) {
+    if (!s_block) {
+      m_dropped.fetch_add(1, std::memory_order_relaxed);
+      m_dropping = true;
+      return;
+    }
+    sched_yield();
+  }
+  if (m_dropping) {
+    uint64_t dropped = m_dropped.load(std::memory_order_relaxed);
+    m_queue[head++ & (s_queueSize - 1)] = Record{DropInfo, 0, 0, 0, 0, dropped - m_queuedDrops};
+    m_queuedDrops = dropped;
+    m_dropping = false;
+  }
+  m_queue[head & (s_queueSize - 1)] = rec;
+  m_head.store(head + 1, std::memory_order_release);
+}
+
+bool StreamTrace::drain() // must be called holding s_guard
+{
+  size_t tail = m_tail.load(std::memory_order_relaxed);
+  size_t head = m_head.load(std::memory_order_acquire);
+  if (tail == head) {
+    return false;
+  }
+  for (; tail != head; ++tail) {
+    if (m_fill + MaxEncodedRecord > BufferSize) {
+      flush();
+      m_tail.store(tail, std::memory_order_release);
+    }
+    encode(m_queue[tail & (s_queueSize - 1)]);
+  }
+  flush();
+  m_tail.store(tail, std::memory_order_release);
+  return true;
+}
+
+void StreamTrace::encode(const Record & rec)
+{
+  uint8_t * pos = m_buffer + m_fill;
+  *pos++ = rec.type;
+  *pos++ = rec.flags;
+  pos = putVarint(pos, rec.stack);
+  if (isEvent(rec.type)) {
+    pos = putVarint(pos, zigzag(rec.time - m_prevTime));
+    pos = putVarint(pos, zigzag(rec.base - m_prevBase));
+    m_prevTime = rec.time;
+    m_prevBase = rec.base;
+  } else {
+    pos = putVarint(pos, rec.time);
+    pos = putVarint(pos, rec.base);
+  }
+  pos = putVarint(pos, rec.size);
+  m_fill = pos - m_buffer;
+}
+
+void StreamTrace::flush()
+{
+  size_t pos = 0;
+  while (pos < m_fill) {
+    ssize_t res = write(m_fd, m_buffer + pos, m_fill - pos);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    pos += res;
+  }
+  m_written += pos;
+  m_fill = 0;
+}
+
+} // namespace trac
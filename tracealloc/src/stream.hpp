@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+
+#include <pthread.h>
+
+#include "trace.hpp"
+
+
+namespace trac
+{
+
+// Hands Records through a bounded single producer queue to a background
+//   flusher thread, which writes them in DeltaEncoding.
+// When the queue is full, the producer either waits for the flusher or
+//   drops the Record, depending on TRAC_BACKPRESSURE (block or drop).
+//   Dropped Records are counted and reported in DropInfo Records, queued
+//   ahead of the next Record kept, so they appear where the drops happened.
+class StreamTrace : public Trace
+{
+  static constexpr size_t BufferSize = 1ul << 16;
+  static constexpr size_t DefaultQueueSize = 1ul << 16;
+
+  static StreamTrace * s_first;
+  static pthread_mutex_t s_guard;
+  static pthread_once_t s_flusherInit;
+  static pthread_t s_flusher;
+  static size_t s_queueSize;
+  static bool s_block;
+
+  static void initFlusher();
+  static void * flusherMain(void * arg);
+
+  // producer side
+  alignas(64) std::atomic<size_t> m_head;
+  std::atomic<uint64_t> m_dropped;
+  uint64_t m_queuedDrops; // reported in DropInfo Records queued already
+  bool m_dropping;
+
+  // flusher side
+  alignas(64) std::atomic<size_t> m_tail;
+  uint64_t m_prevTime;
+  uint64_t m_prevBase;
+  uint8_t * m_buffer;
+  size_t m_fill;
+
+  int m_fd;
+  Record * m_queue;
+  StreamTrace * m_next;
+
+  bool drain();
+  void encode(const Record & rec);
+  void flush();
+
+public:
+  StreamTrace();
+  ~StreamTrace();
+
+  bool open(const char * path, uint64_t id, uint64_t tid);
+  void close() override;
+
+  void put(const Record & rec) override;
+  uint64_t dropped() const override { return m_dropped.load(std::memory_order_relaxed); }
+};
+
+} // namespace trac
@@ -0,0 +1,122 @@
+#include "tags.hpp"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arena.hpp"
+
+
+namespace trac
+{
+
+pthread_mutex_t Tags::s_guard = PTHREAD_MUTEX_INITIALIZER;
+pthread_once_t Tags::s_init = PTHREAD_ONCE_INIT;
+Tags::Slot * Tags::s_slots = nullptr;
+size_t Tags::s_capacity = 0;
+uint32_t Tags::s_count = 0;
+int Tags::s_log = -1;
+thread_local Tags::Cached Tags::t_cache[Tags::CacheSize];
+
+void Tags::init()
+{
+  const char * logpath = getenv("TRAC_LOGPATH");
+  if (logpath) {
+    char logfilename[256];
+    snprintf(logfilename, sizeof(logfilename), "%s/tags.log", logpath);
+    s_log = open(logfilename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  }
+}
+
+void Tags::end()
+{
+  if (s_log >= 0) {
+    close(s_log);
+    s_log = -1;
+  }
+}
+
+uint64_t Tags::hash(const char * name, size_t & length)
+{
+  // FNV-1a
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (length = 0; name[length] && length < MaxName; ++length) {
+    h = (h ^ (uint8_t)name[length]) * 0x100000001b3ull;
+  }
+  return h;
+}
+
+void Tags::grow()
+{
+  size_t capacity = s_capacity? s_capacity * 2 : InitialCapacity;
+  Slot * slots = (Slot *)Arena::allocate(capacity * sizeof(Slot));
+  memset(slots, 0, capacity * sizeof(Slot));
+  size_t mask = capacity - 1;
+  for (size_t idx = 0; idx < s_capacity; ++idx) {
+    if (s_slots[idx].name) {
+      size_t pos = s_slots[idx].hash & mask;
+      while (slots[pos].name) {
+        pos = (pos + 1) & mask;
+      }
+      slots[pos] = s_slots[idx];
+    }
+  }
+  if (s_slots) {
+    Arena::deallocate(s_slots, s_capacity * sizeof(Slot));
+  }
+  s_slots = slots;
+  s_capacity = capacity;
+}
+
+void Tags::emit(uint32_t id, const char * name)
+{
+  if (s_log < 0) {
+    return;
+  }
+  char line[MaxName + 16];
+  int len = snprintf(line, sizeof(line), "%u,%s\n", id, name);
+  if (write(s_log, line, len) < 0) {
+    return;
+  }
+}
+
+uint32_t Tags::intern(const char * name)
+{
+  if (!name || !*name) {
+    return 0;
+  }
+  Cached & cached = t_cache[((uintptr_t)name >> 3) % CacheSize];
+  if (cached.key == name && !strncmp(name, cached.name, MaxName)) {
+    return cached.id;
+  }
+
+  pthread_once(&s_init, init);
+  size_t length;
+  uint64_t h = hash(name, length);
+  pthread_mutex_lock(&s_guard);
+  if ((s_count + 1) * 4 > s_capacity * 3) {
+    grow();
+  }
+  size_t mask = s_capacity - 1;
+  size_t pos = h & mask;
+  for (; s_slots[pos].name; pos = (pos + 1) & mask) {
+    if (s_slots[pos].hash == h && !strncmp(s_slots[pos].name, name, length) && !s_slots[pos].name[length]) {
+      break;
+    }
+  }
+  Slot & slot = s_slots[pos];
+  if (!slot.name) {
+    char * copy = (char *)Arena::allocate(length + 1);
+    memcpy(copy, name, length);
+    copy[length] = '\0';
+    slot = Slot{h, ++s_count, copy};
+    emit(slot.id, copy);
+  }
+  cached = Cached{name, slot.name, slot.id};
+  pthread_mutex_unlock(&s_guard);
+  return cached.id;
+}
+
+} // namespace trac
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+
+namespace trac
+{
+
+// Interned names of trac_tag (see tracealloc.h).
+// Each distinct name receives a 32 bit id (0 means untagged) when first seen,
+//   which is written to tags.log in TRAC_LOGPATH as "<id>,<name>". Records
+//   and Registry entries only carry the id. A small per-thread cache keyed
+//   by the name's address saves the lock for names passed repeatedly, as
+//   string literals are in allocation loops.
+class Tags
+{
+  struct Slot
+  {
+    uint64_t hash;
+    uint32_t id;
+    const char * name;  // interned copy, nullptr if unused
+  };
+
+  struct Cached
+  {
+    const char * key;   // address passed by the caller
+    const char * name;  // interned copy, compared to tell reused buffers apart
+    uint32_t id;
+  };
+
+  static constexpr size_t InitialCapacity = 64;
+  static constexpr size_t CacheSize = 16;
+  static constexpr size_t MaxName = 255;
+
+  static pthread_mutex_t s_guard;
+  static pthread_once_t s_init;
+  static Slot * s_slots;
+  static size_t s_capacity;
+  static uint32_t s_count;
+  static int s_log;
+  static thread_local Cached t_cache[CacheSize];
+
+  static void init();
+  static uint64_t hash(const char * name, size_t & length);
+  static void grow();
+  static void emit(uint32_t id, const char * name);
+
+public:
+  static uint32_t intern(const char * name);
+  static void end();
+};
+
+} // namespace trac
@@ -0,0 +1,162 @@
+#include "trace.hpp"
+
+#include "clock.hpp"
+#include "stream.hpp"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+namespace trac
+{
+
+static bool g_asyncTrace = false;
+static pthread_once_t g_traceModeInit = PTHREAD_ONCE_INIT;
+
+static void initTraceMode()
+{
+  const char * mode = getenv("TRAC_TRACEMODE");
+  g_asyncTrace = mode && !strcmp(mode, "async");
+}
+
+Trace * Trace::open(const char * path, uint64_t id, uint64_t tid)
+{
+  pthread_once(&g_traceModeInit, initTraceMode);
+  if (g_asyncTrace) {
+    StreamTrace * trace = new StreamTrace();
+    if (!trace) {
+      return nullptr;
+    }
+    if (trace->open(path, id, tid)) {
+      return trace;
+    }
+    delete trace;
+  } else {
+    MappedTrace * trace = new MappedTrace();
+    if (!trace) {
+      return nullptr;
+    }
+    if (trace->open(path, id, tid)) {
+      return trace;
+    }
+    delete trace;
+  }
+  return nullptr;
+}
+
+void Trace::initHeader(TraceHeader & header, uint64_t id, uint64_t tid, TraceEncoding encoding)
+{
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TraceMagic, sizeof(header.magic));
+  header.version = TraceVersion;
+  header.recordSize = sizeof(Record);
+  header.id = id;
+  header.tid = tid;
+  header.encoding = encoding;
+  header.clock = Clock::usesTicks()? TickClock : NanosecondClock;
+}
+
+MappedTrace::MappedTrace()
+: m_fd(-1)
+, m_segment(nullptr)
+, m_segmentOffset(0)
+, m_pos(0)
+{ }
+
+MappedTrace::~MappedTrace()
+{
+  close();
+}
+
+bool MappedTrace::open(const char * path, uint64_t id, uint64_t tid)
+{
+  close();
+  m_fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (m_fd < 0) {
+    return false;
+  }
+  if (!map(0)) {
+    ::close(m_fd);
+    m_fd = -1;
+    return false;
+  }
+  TraceHeader header;
+  initHeader(header, id, tid, FixedEncoding);
+  memcpy(m_segment, &header, sizeof(header));
+  m_pos = sizeof(header);
+  return true;
+}
+
+void MappedTrace::close()
+{
+  if (m_segment) {
+    munmap(m_segment, SegmentSize);
+    m_segment = nullptr;
+  }
+  if (m_fd >= 0) {
+    // drop the zero filled tail of the last segment
+    m_written = m_segmentOffset + m_pos;
+    ftruncate(m_fd, m_written);
+    ::close(m_fd);
+    m_fd = -1;
+  }
+  m_segmentOffset = 0;
+  m_pos = 0;
+}
+
+bool MappedTrace::map(size_t offset)
+{
+  if (m_segment) {
+    munmap(m_segment, SegmentSize);
+    m_segment = nullptr;
+  }
+  if (ftruncate(m_fd, offset + SegmentSize)) {
+    return false;
+  }
+  // a shared file mapping hands records to the page cache as soon as they are written,
+  //   so they survive the process being killed
+  void * segment = mmap(nullptr, SegmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, offset);
+  if (segment == MAP_FAILED) {
+    return false;
+  }
+  m_segment = (char *)segment;
+  m_segmentOffset = offset;
+  m_pos = 0;
+  return true;
+}
+
+Record * MappedTrace::next()
+{
+  if (!m_segment) {
+    return nullptr;
+  }
+  if (m_pos + sizeof(Record) > SegmentSize) {
+    if (!map(m_segmentOffset + SegmentSize)) {
+      return nullptr;
+    }
+  }
+  Record * rec = (Record *)(m_segment + m_pos);
+  m_pos += sizeof(Record);
+  return rec;
+}
+
+void MappedTrace::put(const Record & rec)
+{
+  Record * slot = next();
+  if (!slot) {
+    return;
+  }
+  // publish the type last, so a torn record reads as EndOfTrace
+  slot->flags = rec.flags;
+  slot->stack = rec.stack;
+  slot->time = rec.time;
+  slot->base = rec.base;
+  slot->size = rec.size;
+  __atomic_store_n(&slot->type, rec.type, __ATOMIC_RELEASE);
+}
+
+} // namespace trac
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.hpp"
+
+
+namespace trac
+{
+
+// Binary allocation trace, one file per Handler.
+// A TraceHeader is followed by Records, either stored as is (FixedEncoding)
+//   or as a stream of varints with timestamps and addresses of events
+//   delta encoded against the previous event (DeltaEncoding).
+// Fixed encoding files grow in segments and unused space is zero filled,
+//   so a Record with type EndOfTrace marks the end of a trace that was
+//   not closed properly.
+
+static constexpr char TraceMagic[8] = {'T', 'R', 'A', 'C', 'A', 'L', 'O', 'C'};
+static constexpr uint32_t TraceVersion = 2;
+
+struct TraceHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t recordSize;
+  uint64_t id;
+  uint64_t tid;
+  uint32_t encoding;
+  uint32_t clock;
+  uint64_t reserved[3];
+};
+
+enum TraceEncoding : uint32_t
+{
+  FixedEncoding = 0,
+  DeltaEncoding = 1,
+};
+
+enum TraceClock : uint32_t
+{
+  NanosecondClock = 0, // nanoseconds of CLOCK_MONOTONIC_RAW
+  TickClock       = 1, // cycle counter ticks, converted via ClockInfo Records
+};
+
+enum RecordType : uint8_t
+{
+  EndOfTrace = 0,
+  AllocEvent = 1,
+  FreeEvent  = 2,
+  DropInfo   = 4, // size: number of records dropped since the previous DropInfo
+  ClockInfo  = 5, // time: ticks, base: simultaneous CLOCK_MONOTONIC_RAW nanoseconds
+  WeightInfo = 6, // size: bytes represented by the sampled event it follows
+  NodeInfo   = 7, // base: node of the allocating cpu, size: node bound to (TRAC_NUMA), follows an event
+  PrefaultInfo = 8, // time: when done, base: allocation, size: duration in ns, stack: node holding
+                    //   most sampled pages (~0 if unknown), flags: percentage of sampled pages there
+  TagInfo    = 9, // base: start of the named range, size: its length, stack: Tags id (0 removes the name)
+  MapInfo    = 10, // flags: see below, stack: Tags id of the file's path, base: offset into it,
+                   //   follows the event of a region mapped by the program (TRAC_MAPS)
+};
+
+// Record::flags of an AllocEvent: log2 of the page size backing the allocation
+//   (0 if not controlled), TransparentPages if huge pages were only advised
+static constexpr uint8_t PageShiftMask = 0x3f;
+static constexpr uint8_t TransparentPages = 0x40;
+
+// Record::flags of a NodeInfo: pages were interleaved over all nodes instead
+static constexpr uint8_t NodeInterleaved = 0x01;
+
+// Record::flags of a MapInfo: backing of the region, anonymous pages if not MapFile
+static constexpr uint8_t MapFile = 0x01;
+static constexpr uint8_t MapShared = 0x02;
+static constexpr uint8_t MapBreak = 0x04; // grown by brk/sbrk
+
+inline bool isEvent(uint8_t type)
+{
+  return type == AllocEvent || type == FreeEvent;
+}
+
+// records describing the event preceding them
+inline bool isInfo(uint8_t type)
+{
+  return type == WeightInfo || type == NodeInfo || type == MapInfo;
+}
+
+struct Record
+{
+  uint8_t  type;
+  uint8_t  flags;
+  uint32_t stack;
+  uint64_t time;    // in units of TraceHeader::clock
+  uint64_t base;
+  uint64_t size;
+};
+
+static_assert(sizeof(TraceHeader) % sizeof(Record) == 0, "TraceHeader must be Record aligned");
+
+// Upper bound of the DeltaEncoding size of a single Record
+static constexpr size_t MaxEncodedRecord = 2 + 4 * 10;
+
+inline uint64_t zigzag(int64_t value)
+{
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value)
+{
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+inline uint8_t * putVarint(uint8_t * pos, uint64_t value)
+{
+  while (value >= 0x80) {
+    *pos++ = (uint8_t)value | 0x80;
+    value >>= 7;
+  }
+  *pos++ = (uint8_t)value;
+  return pos;
+}
+
+inline const uint8_t * getVarint(const uint8_t * pos, const uint8_t * end, uint64_t & value)
+{
+  value = 0;
+  for (unsigned shift = 0; pos < end && shift < 64; shift += 7) {
+    uint8_t byte = *pos++;
+    value |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return pos;
+    }
+  }
+  return nullptr;
+}
+
+// Sink for the Records of one Handler
+class Trace : public ArenaObject
+{
+public:
+  static Trace * open(const char * path, uint64_t id, uint64_t tid);
+
+  virtual ~Trace() { }
+
+  virtual void put(const Record & rec) = 0;
+  virtual void close() = 0;
+
+  // bytes of the file, complete once closed
+  uint64_t written() const { return m_written; }
+  virtual uint64_t dropped() const { return 0; }
+
+protected:
+  uint64_t m_written;
+
+  Trace() : m_written(0) { }
+
+  static void initHeader(TraceHeader & header, uint64_t id, uint64_t tid, TraceEncoding encoding);
+};
+
+// Writes FixedEncoding Records into memory mapped file segments
+class MappedTrace : public Trace
+{
+  static constexpr size_t SegmentSize = 1ul << 20;
+
+  int m_fd;
+  char * m_segment;
+  size_t m_segmentOffset;
+  size_t m_pos;
+
+  bool map(size_t offset);
+  Record * next();
+
+public:
+  MappedTrace();
+  ~MappedTrace();
+
+  bool open(const char * path, uint64_t id, uint64_t tid);
+  void close() override;
+
+  void put(const Record & rec) override;
+};
+
+} // namespace trac
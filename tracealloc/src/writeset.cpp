@@ -0,0 +1,154 @@
+#include "writeset.hpp"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <new>
+
+#include "clock.hpp"
+
+
+namespace trac
+{
+
+pthread_once_t WriteSet::s_init = PTHREAD_ONCE_INIT;
+bool WriteSet::s_active = false;
+size_t WriteSet::s_page = 4096;
+int WriteSet::s_pagemap = -1;
+int WriteSet::s_clearRefs = -1;
+int WriteSet::s_log = -1;
+Periodic WriteSet::s_tracker;
+ArenaVector<WriteSet::Range> * WriteSet::s_chunk = nullptr;
+
+bool WriteSet::clear()
+{
+  // 4 clears the soft-dirty bits of all pages
+  return pwrite(s_clearRefs, "4", 1, 0) == 1;
+}
+
+bool WriteSet::supported()
+{
+  // kernels without CONFIG_MEM_SOFT_DIRTY never set the bit
+  volatile char * probe = (char *)mmap(nullptr, s_page, PROT_READ | PROT_WRITE,
+                                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (probe == MAP_FAILED) {
+    return false;
+  }
+  uint64_t entry = 0;
+  bool res = clear();
+  if (res) {
+    *probe = 1;
+    res = pread(s_pagemap, &entry, sizeof(entry), ((uintptr_t)probe / s_page) * sizeof(entry)) == sizeof(entry)
+       && (entry & SoftDirty);
+  }
+  munmap((void *)probe, s_page);
+  return res;
+}
+
+void WriteSet::init()
+{
+  const char * epoch = getenv("TRAC_DIRTY_EPOCH");
+  const char * logpath = getenv("TRAC_LOGPATH");
+  if (!epoch || !logpath || !strtoul(epoch, nullptr, 0)) {
+    return;
+  }
+  s_page = sysconf(_SC_PAGESIZE);
+  s_pagemap = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+  s_clearRefs = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+  if (s_pagemap < 0 || s_clearRefs < 0 || !supported()) {
+    printf("TRAC_DIRTY_EPOCH: soft-dirty bits not available, not tracking write sets\n");
+    if (s_pagemap >= 0) {
+      close(s_pagemap);
+    }
+    if (s_clearRefs >= 0) {
+      close(s_clearRefs);
+    }
+    return;
+  }
+  char logfilename[256];
+  snprintf(logfilename, sizeof(logfilename), "%s/dirty.log", logpath);
+  s_log = open(logfilename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  if (s_log < 0) {
+    printf("TRAC_DIRTY_EPOCH: can not open %s\n", logfilename);
+    return;
+  }
+  s_chunk = new (Arena::allocate(sizeof(ArenaVector<Range>))) ArenaVector<Range>();
+  s_chunk->reserve(ChunkSize);
+  clear();
+  // the last epoch ends early at TRAC_END
+  s_active = s_tracker.start(strtoul(epoch, nullptr, 0) * 1000000ull, &tick, true);
+  if (!s_active) {
+    printf("Write set tracker could not be started\n");
+  }
+}
+
+void WriteSet::begin()
+{
+  pthread_once(&s_init, init);
+}
+
+void WriteSet::end()
+{
+  if (!s_active) {
+    return;
+  }
+  s_tracker.stop();
+  s_active = false;
+  close(s_log);
+  close(s_pagemap);
+  close(s_clearRefs);
+}
+
+void WriteSet::collect(uintptr_t base, const Registry::Alloc & info, void * data)
+{
+  s_chunk->push_back(Range{base, info.size});
+}
+
+void WriteSet::scan(const Range & range, char * buffer, size_t & fill)
+{
+  // freed meanwhile, the pages read as not present or belong to a new allocation
+  uint64_t entries[BatchSize];
+  size_t first = range.base / s_page;
+  size_t end = (range.base + range.size + s_page - 1) / s_page;
+  size_t dirty = 0;
+  for (size_t page = first; page < end; page += BatchSize) {
+    size_t count = (end - page < BatchSize)? end - page : BatchSize;
+    ssize_t res = pread(s_pagemap, entries, count * sizeof(uint64_t), page * sizeof(uint64_t));
+    if (res <= 0) {
+      break;
+    }
+    for (size_t idx = 0; idx < res / sizeof(uint64_t); ++idx) {
+      dirty += (entries[idx] & SoftDirty)? 1 : 0;
+    }
+  }
+  if (dirty) {
+    fill += snprintf(buffer + fill, 64, "%lx,%lu,%lu\n", range.base, dirty, end - first);
+  }
+}
+
+void WriteSet::tick()
+{
+  char buffer[1 << 14];
+  uint64_t now = Clock::ns();
+  size_t fill = snprintf(buffer, sizeof(buffer), "=%lu.%09lu\n", now / 1000000000ul, now % 1000000000ul);
+  // taken in chunks, so the registry is neither copied nor held up by reading pagemap
+  uint64_t cursor = 0;
+  do {
+    s_chunk->clear();
+    Registry::walk(cursor, ChunkSize, &collect, nullptr);
+    for (const Range & range : *s_chunk) {
+      scan(range, buffer, fill);
+      if (sizeof(buffer) - fill < 64) {
+        write(s_log, buffer, fill);
+        fill = 0;
+      }
+    }
+  } while (cursor);
+  write(s_log, buffer, fill);
+  clear();
+}
+
+} // namespace trac
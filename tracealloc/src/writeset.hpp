@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "arena.hpp"
+#include "periodic.hpp"
+#include "registry.hpp"
+
+
+namespace trac
+{
+
+// Write working sets of registered allocations from the kernel's soft-dirty
+//   bits, without hardware counters. Every TRAC_DIRTY_EPOCH milliseconds, the
+//   pages of all live allocations are looked up in /proc/self/pagemap and the
+//   bits are cleared through /proc/self/clear_refs for the next epoch.
+// Counts go to dirty.log in TRAC_LOGPATH, an epoch being a line
+//   =<sec.nsec> (CLOCK_MONOTONIC_RAW at its end) followed by
+//   <allocation>,<dirty pages>,<pages> for each allocation written to.
+// Pages are those overlapping an allocation, so writes to neighbours sharing
+//   a page count as well. Clearing write protects all pages of the process,
+//   so the first write to a page per epoch costs a minor fault.
+class WriteSet
+{
+  struct Range
+  {
+    uintptr_t base;
+    size_t size;
+  };
+
+  static constexpr uint64_t SoftDirty = 1ull << 55; // pagemap entry bit
+  static constexpr size_t BatchSize = 512;          // pagemap entries per read
+  static constexpr size_t ChunkSize = 256;          // allocations taken from the registry at once
+
+  static pthread_once_t s_init;
+  static bool s_active;
+  static size_t s_page;
+  static int s_pagemap;
+  static int s_clearRefs;
+  static int s_log;
+  static Periodic s_tracker;
+  static ArenaVector<Range> * s_chunk;
+
+  static void init();
+  static bool clear();
+  static bool supported();
+  static void collect(uintptr_t base, const Registry::Alloc & info, void * data);
+  static void tick();
+  static void scan(const Range & range, char * buffer, size_t & fill);
+
+public:
+  static void begin();
+  static void end();
+};
+
+} // namespace trac
@@ -0,0 +1,141 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+// Measures ns per call of one allocator entry point, natively or with the
+//   interposer preloaded (see allocbench.sh for the sweep).
+// Each round allocates <count> blocks with sizes drawn uniformly from
+//   [<min>, <max>] by a fixed seed, so native and preloaded runs see the same
+//   sequence, and times only the calls of <op>. The loop runs <depth> frames
+//   below main, giving TRAC_STACKLEVELS something to unwind.
+// Prints a single JSON object.
+
+
+enum Op { OpMalloc, OpFree, OpCalloc, OpRealloc, OpMemalign };
+
+static const char * opNames[] = { "malloc", "free", "calloc", "realloc", "memalign" };
+
+struct Bench
+{
+  enum Op op;
+  size_t minSize;
+  size_t maxSize;
+  size_t count;
+  size_t rounds;
+  void ** blocks;
+  size_t * sizes;
+  uint64_t random;
+  uint64_t totalNs;
+  uint64_t bestNs;
+};
+
+static void runRound(struct Bench * bench)
+{
+  size_t count = bench->count;
+  for (size_t i = 0; i < count; ++i) {
+    bench->sizes[i] = nextSize(&bench->random, bench->minSize, bench->maxSize);
+  }
+  // blocks to be freed or resized are set up untimed
+  if (bench->op == OpFree || bench->op == OpRealloc) {
+    for (size_t i = 0; i < count; ++i) {
+      bench->blocks[i] = malloc(nextSize(&bench->random, bench->minSize, bench->maxSize));
+    }
+  }
+  uint64_t start = now();
+  switch (bench->op) {
+  case OpMalloc:
+    for (size_t i = 0; i < count; ++i) {
+      bench->blocks[i] = malloc(bench->sizes[i]);
+    }
+    break;
+  case OpFree:
+    for (size_t i = 0; i < count; ++i) {
+      free(bench->blocks[i]);
+    }
+    break;
+  case OpCalloc:
+    for (size_t i = 0; i < count; ++i) {
+      bench->blocks[i] = calloc(1, bench->sizes[i]);
+    }
+    break;
+  case OpRealloc:
+    for (size_t i = 0; i < count; ++i) {
+      bench->blocks[i] = realloc(bench->blocks[i], bench->sizes[i]);
+    }
+    break;
+  case OpMemalign:
+    for (size_t i = 0; i < count; ++i) {
+      if (posix_memalign(&bench->blocks[i], 64, bench->sizes[i])) {
+        bench->blocks[i] = NULL;
+      }
+    }
+    break;
+  }
+  uint64_t elapsed = now() - start;
+  if (bench->op != OpFree) {
+    for (size_t i = 0; i < count; ++i) {
+      free(bench->blocks[i]);
+    }
+  }
+  bench->totalNs += elapsed;
+  if (!bench->bestNs || elapsed < bench->bestNs) {
+    bench->bestNs = elapsed;
+  }
+}
+
+static __attribute__((noinline)) void descend(struct Bench * bench, size_t depth)
+{
+  if (depth) {
+    descend(bench, depth - 1);
+    __asm__ __volatile__ ("" ::: "memory"); // keeps the call from becoming a tail call
+    return;
+  }
+  for (size_t r = 0; r < bench->rounds; ++r) {
+    runRound(bench);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc < 4) {
+    fprintf(stderr, "Usage: allocbench <malloc|free|calloc|realloc|memalign> <min size> <max size> [depth] [count] [rounds]\n");
+    return 1;
+  }
+  struct Bench bench;
+  memset(&bench, 0, sizeof(bench));
+  int op = lookupName(opNames, sizeof(opNames) / sizeof(opNames[0]), argv[1]);
+  bench.minSize = strtoul(argv[2], NULL, 0);
+  bench.maxSize = strtoul(argv[3], NULL, 0);
+  size_t depth = (argc > 4)? strtoul(argv[4], NULL, 0) : 0;
+  bench.count = (argc > 5)? strtoul(argv[5], NULL, 0) : 1024;
+  bench.rounds = (argc > 6)? strtoul(argv[6], NULL, 0) : 100;
+  if (op < 0 || !bench.minSize || bench.maxSize < bench.minSize || !bench.count || !bench.rounds) {
+    fprintf(stderr, "allocbench: invalid arguments\n");
+    return 1;
+  }
+  bench.op = op;
+  bench.random = 0x9e3779b97f4a7c15ull;
+  bench.blocks = malloc(bench.count * sizeof(void *));
+  bench.sizes = malloc(bench.count * sizeof(size_t));
+
+  // one untimed round warms up the allocator and the tracer's tables
+  size_t rounds = bench.rounds;
+  bench.rounds = 1;
+  descend(&bench, depth);
+  bench.rounds = rounds;
+  bench.totalNs = 0;
+  bench.bestNs = 0;
+  descend(&bench, depth);
+
+  double ops = (double)bench.count * bench.rounds;
+  printf("{\"op\": \"%s\", \"min_size\": %zu, \"max_size\": %zu, \"depth\": %zu, \"count\": %zu, \"rounds\": %zu, "
+         "\"ns_per_op\": %.2f, \"best_ns_per_op\": %.2f}\n",
+         opNames[bench.op], bench.minSize, bench.maxSize, depth, bench.count, bench.rounds,
+         bench.totalNs / ops, bench.bestNs / (double)bench.count);
+  free(bench.blocks);
+  free(bench.sizes);
+  return 0;
+}
@@ -0,0 +1,42 @@
+#!/bin/bash
+# Sweeps allocbench natively and with the interposer preloaded, writing a JSON array.
+# usage: allocbench.sh <libtracealloc.so> <allocbench> [output file]
+# THRESHOLD (default 4096) is the TRAC_THRESHOLD the size ranges are placed around,
+# STACKLEVELS the TRAC_STACKLEVELS to sweep (default "0 8 32"), DEPTH the frames below main,
+# COUNT and ROUNDS are passed on to allocbench.
+
+. "$(dirname "$0")/bench.sh"
+
+threshold=${THRESHOLD:-4096}
+stacklevels=${STACKLEVELS:-0 8 32}
+depth=${DEPTH:-32}
+count=${COUNT:-1024}
+rounds=${ROUNDS:-100}
+
+# below, straddling and above the threshold
+ranges="$((threshold / 16)):$((threshold / 4)) $((threshold / 2)):$((threshold * 2)) $((threshold * 4)):$((threshold * 16))"
+ops="malloc free calloc realloc memalign"
+
+run() { # <mode> <stacklevels> <logging> <op> <min> <max> [env...]
+  local mode=$1 levels=$2 logging=$3 op=$4 min=$5 max=$6
+  shift 6
+  measure "$(printf '"mode": "%s", "threshold": %d, "stacklevels": %d, "logging": %s' $mode $threshold $levels $logging)" \
+    "$op $min $max $depth $count $rounds" "$@"
+}
+
+sweep() {
+  for op in $ops; do
+    for range in $ranges; do
+      min=${range%:*}
+      max=${range#*:}
+      run native 0 false $op $min $max
+      for levels in $stacklevels; do
+        run preload $levels false $op $min $max LD_PRELOAD="$lib" TRAC_THRESHOLD=$threshold TRAC_STACKLEVELS=$levels
+        rm -rf "$logdir"/*
+        run preload $levels true $op $min $max LD_PRELOAD="$lib" TRAC_THRESHOLD=$threshold TRAC_STACKLEVELS=$levels TRAC_LOGPATH="$logdir"
+      done
+    done
+  done
+}
+
+writeJson sweep
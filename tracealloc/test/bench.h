@@ -0,0 +1,35 @@
+#pragma once
+
+// Helpers shared by allocbench and threadbench.
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+static inline uint64_t now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// uniform in [min, max] from a xorshift64 state, so runs with the same seed
+//   see the same sequence
+static inline size_t nextSize(uint64_t * random, size_t min, size_t max)
+{
+  *random ^= *random << 13;
+  *random ^= *random >> 7;
+  *random ^= *random << 17;
+  return min + *random % (max - min + 1);
+}
+
+// index of name in names, -1 if missing
+static inline int lookupName(const char * const * names, size_t count, const char * name)
+{
+  for (size_t i = 0; i < count; ++i) {
+    if (!strcmp(name, names[i])) {
+      return i;
+    }
+  }
+  return -1;
+}
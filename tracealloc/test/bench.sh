@@ -0,0 +1,40 @@
+# Shared by allocbench.sh and threadbench.sh, which source it with their arguments
+#   <libtracealloc.so> <bench> [output file] and pass their sweep to writeJson.
+# Sets lib, bench, commit and logdir, an empty log directory removed on exit.
+
+name=$(basename "$0" .sh)
+lib=$(realpath "$1")
+bench=$(realpath "$2")
+out=${3:-/dev/stdout}
+if test ! -f "$lib" -o ! -x "$bench"; then
+  echo "usage: $name.sh <libtracealloc.so> <$name> [output file]" >&2
+  exit 1
+fi
+
+commit=$(git -C "$(dirname "$0")" rev-parse --short HEAD 2>/dev/null)
+
+logdir=$(mktemp -d)
+trap 'rm -rf "$logdir"' EXIT
+
+sep=""
+measure() { # <JSON fields> <bench arguments> [env...]
+  local fields=$1 args=$2
+  shift 2
+  local res
+  res=$(env "$@" "$bench" $args | grep '^{')
+  if test -z "$res"; then
+    echo "$name failed: $args" >&2
+    return
+  fi
+  printf '%s  {"commit": "%s", %s, "result": %s}' "$sep" "$commit" "$fields" "$res"
+  sep=$',\n'
+}
+
+writeJson() { # <sweep function>
+  {
+    echo "["
+    "$1"
+    echo
+    echo "]"
+  } > "$out"
+}
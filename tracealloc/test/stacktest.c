@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Allocates and maps through every entry point above the threshold stacktest.sh
+//   sets, so the first frame of each traced stack must lie in this program.
+
+
+#define Large (1 << 20)
+
+static void * volatile g_blocks[8];
+static char * volatile g_mapped;
+
+static __attribute__((noinline)) void allocate()
+{
+  g_blocks[0] = malloc(Large);
+  g_blocks[1] = calloc(1, Large);
+  if (posix_memalign((void **)&g_blocks[2], 64, Large)) {
+    g_blocks[2] = NULL;
+  }
+  // untraced glibc allocation becoming traced
+  g_blocks[3] = malloc(16);
+  g_blocks[3] = realloc(g_blocks[3], Large);
+  // traced allocation resized
+  g_blocks[0] = realloc(g_blocks[0], 2 * Large);
+  // regions traced with TRAC_MAPS
+  g_mapped = mmap(NULL, 4 * Large, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (g_mapped == MAP_FAILED) {
+    g_mapped = NULL;
+  }
+  if (sbrk(Large) == (void *)-1) {
+    perror("sbrk");
+  }
+}
+
+static __attribute__((noinline)) void release()
+{
+  for (size_t i = 0; i < sizeof(g_blocks) / sizeof(g_blocks[0]); ++i) {
+    free(g_blocks[i]);
+    g_blocks[i] = NULL;
+  }
+  if (g_mapped) {
+    // cut in three, the outer parts stay mapped
+    munmap(g_mapped + Large, Large);
+    munmap(g_mapped, 4 * Large);
+    g_mapped = NULL;
+  }
+  sbrk(-Large);
+}
+
+int main(int argc, char *argv[])
+{
+  allocate();
+  release();
+  printf("stacktest: done\n");
+  return 0;
+}
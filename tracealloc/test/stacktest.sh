@@ -0,0 +1,49 @@
+#!/bin/bash
+# Checks that traced stacks start at the caller of the interposed function,
+#   with no frame of the interposer itself, for stacktest's events.
+# usage: stacktest.sh <libtracealloc.so> <stacktest> <tracedecode>
+
+lib=$(realpath "$1")
+test=$(realpath "$2")
+decode=$(realpath "$3")
+if test ! -f "$lib" -o ! -x "$test" -o ! -x "$decode"; then
+  echo "usage: stacktest.sh <libtracealloc.so> <stacktest> <tracedecode>" >&2
+  exit 1
+fi
+
+logdir=$(mktemp -d)
+trap 'rm -rf "$logdir"' EXIT
+
+# the program itself is listed without a name in maps.log
+programIndex() {
+  sed -n 's/^\([0-9]*\): *$/\1/p; s|^\([0-9]*\): '"$test"'$|\1|p' "$logdir/maps.log" | head -n 1
+}
+
+failed=0
+for unwinder in backtrace fp; do
+  rm -rf "$logdir"/*
+  env LD_PRELOAD="$lib" TRAC_LOGPATH="$logdir" TRAC_MAPS=trace TRAC_THRESHOLD=0x10000 TRAC_STACKLEVELS=1 TRAC_UNWIND=$unwinder "$test" >/dev/null || exit 1
+  program=$(programIndex)
+  if test -z "$program"; then
+    echo "stacktest: program missing in maps.log" >&2
+    exit 1
+  fi
+  events=0
+  for trace in "$logdir"/alloc_*.trc; do
+    while IFS=, read -r time base size frame rest; do
+      # events closed at TRAC_END carry no stack
+      test -z "$frame" && continue
+      events=$((events + 1))
+      if test "${frame%%+*}" != "$program"; then
+        echo "stacktest ($unwinder): first frame $frame not in the program: $time,$base,$size" >&2
+        failed=1
+      fi
+    done < <("$decode" -s "$logdir/stacks.log" "$trace" | grep '^[+-]')
+  done
+  # 6 allocation and 4 free events of the heap, 4 and 4 of the mapped regions
+  if test "$events" -ne 18; then
+    echo "stacktest ($unwinder): $events events with stacks instead of 18" >&2
+    failed=1
+  fi
+done
+exit $failed
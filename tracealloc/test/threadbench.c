@@ -0,0 +1,295 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+
+// Measures allocator throughput and latency with many threads, natively or
+//   with the interposer preloaded (see threadbench.sh for the sweep).
+// Patterns:
+//   local     each thread frees its own blocks
+//   producer  odd threads free the blocks of their even neighbour
+//   exchange  every thread sends blocks to all others, which free them
+//   churn     every thread repeatedly starts a short lived thread whose
+//             blocks it frees after joining
+// Latencies are those of single malloc and free calls (for churn of a whole
+//   thread start, allocation and join), of which every <stride>-th is kept.
+// Prints a single JSON object.
+
+
+enum Pattern { Local, Producer, Exchange, Churn };
+
+static const char * patternNames[] = { "local", "producer", "exchange", "churn" };
+
+#define RingSize 256
+#define MaxSamples (1 << 16)
+#define ChurnBlocks 16
+
+struct Ring // single producer, single consumer
+{
+  _Atomic size_t head;
+  char pad0[56];
+  _Atomic size_t tail;
+  char pad1[56];
+  void * slots[RingSize];
+};
+
+struct Worker
+{
+  pthread_t thread;
+  size_t id;
+  uint64_t * samples;
+  size_t sampleCount;
+  uint64_t ops;
+  uint64_t random;
+};
+
+static enum Pattern g_pattern;
+static size_t g_threads;
+static size_t g_ops;
+static size_t g_minSize;
+static size_t g_maxSize;
+static size_t g_stride;
+static struct Ring * g_rings; // [from * g_threads + to]
+static _Atomic size_t g_done;
+static pthread_barrier_t g_start;
+
+static void sample(struct Worker * worker, uint64_t ns)
+{
+  if (worker->ops++ % g_stride == 0 && worker->sampleCount < MaxSamples) {
+    worker->samples[worker->sampleCount++] = ns;
+  }
+}
+
+static void * timedMalloc(struct Worker * worker)
+{
+  size_t size = nextSize(&worker->random, g_minSize, g_maxSize);
+  uint64_t start = now();
+  void * ptr = malloc(size);
+  sample(worker, now() - start);
+  *(volatile char *)ptr = 0;
+  return ptr;
+}
+
+static void timedFree(struct Worker * worker, void * ptr)
+{
+  uint64_t start = now();
+  free(ptr);
+  sample(worker, now() - start);
+}
+
+static int push(struct Ring * ring, void * ptr)
+{
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&ring->tail, memory_order_acquire) >= RingSize) {
+    return 0;
+  }
+  ring->slots[head % RingSize] = ptr;
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  return 1;
+}
+
+static void * pop(struct Ring * ring)
+{
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  if (tail == atomic_load_explicit(&ring->head, memory_order_acquire)) {
+    return NULL;
+  }
+  void * ptr = ring->slots[tail % RingSize];
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+  return ptr;
+}
+
+static size_t drain(struct Worker * worker)
+{
+  size_t freed = 0;
+  for (size_t from = 0; from < g_threads; ++from) {
+    void * ptr;
+    while ((ptr = pop(&g_rings[from * g_threads + worker->id]))) {
+      timedFree(worker, ptr);
+      ++freed;
+    }
+  }
+  return freed;
+}
+
+static void runLocal(struct Worker * worker)
+{
+  void * slots[64] = { NULL };
+  for (size_t i = 0; i < g_ops; ++i) {
+    size_t pos = i % 64;
+    if (slots[pos]) {
+      timedFree(worker, slots[pos]);
+    }
+    slots[pos] = timedMalloc(worker);
+  }
+  for (size_t pos = 0; pos < 64; ++pos) {
+    if (slots[pos]) {
+      timedFree(worker, slots[pos]);
+    }
+  }
+}
+
+static void runProducer(struct Worker * worker)
+{
+  size_t partner = worker->id ^ 1;
+  if (partner >= g_threads) {
+    runLocal(worker); // odd thread count, the last thread has no partner
+    return;
+  }
+  if (worker->id % 2 == 0) {
+    struct Ring * ring = &g_rings[worker->id * g_threads + partner];
+    for (size_t i = 0; i < g_ops; ++i) {
+      void * ptr = timedMalloc(worker);
+      while (!push(ring, ptr));
+    }
+  } else {
+    size_t freed = 0;
+    while (freed < g_ops) {
+      freed += drain(worker);
+    }
+  }
+}
+
+static void runExchange(struct Worker * worker)
+{
+  // blocks go round robin to all threads including this one
+  for (size_t i = 0; i < g_ops; ++i) {
+    void * ptr = timedMalloc(worker);
+    struct Ring * ring = &g_rings[worker->id * g_threads + (worker->id + i) % g_threads];
+    while (!push(ring, ptr)) {
+      drain(worker);
+    }
+    if (i % 16 == 0) {
+      drain(worker);
+    }
+  }
+  atomic_fetch_add(&g_done, 1);
+  while (atomic_load(&g_done) < g_threads) {
+    drain(worker);
+  }
+  drain(worker);
+}
+
+static void * churnChild(void * arg)
+{
+  void ** blocks = arg;
+  for (size_t i = 0; i < ChurnBlocks; ++i) {
+    blocks[i] = malloc(g_minSize + i * (g_maxSize - g_minSize) / ChurnBlocks);
+  }
+  return NULL;
+}
+
+static void runChurn(struct Worker * worker)
+{
+  void * blocks[ChurnBlocks];
+  size_t spawns = g_ops / ChurnBlocks? g_ops / ChurnBlocks : 1;
+  for (size_t i = 0; i < spawns; ++i) {
+    pthread_t child;
+    uint64_t start = now();
+    if (pthread_create(&child, NULL, churnChild, blocks)) {
+      break;
+    }
+    pthread_join(child, NULL);
+    // blocks of the exited thread are freed here
+    for (size_t idx = 0; idx < ChurnBlocks; ++idx) {
+      free(blocks[idx]);
+    }
+    sample(worker, now() - start);
+  }
+}
+
+static void * workerMain(void * arg)
+{
+  struct Worker * worker = arg;
+  pthread_barrier_wait(&g_start);
+  switch (g_pattern) {
+  case Local:
+    runLocal(worker);
+    break;
+  case Producer:
+    runProducer(worker);
+    break;
+  case Exchange:
+    runExchange(worker);
+    break;
+  case Churn:
+    runChurn(worker);
+    break;
+  }
+  pthread_barrier_wait(&g_start);
+  return NULL;
+}
+
+static int compare(const void * a, const void * b)
+{
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc < 3) {
+    fprintf(stderr, "Usage: threadbench <local|producer|exchange|churn> <threads> [ops per thread] [min size] [max size]\n");
+    return 1;
+  }
+  int pattern = lookupName(patternNames, sizeof(patternNames) / sizeof(patternNames[0]), argv[1]);
+  g_threads = strtoul(argv[2], NULL, 0);
+  g_ops = (argc > 3)? strtoul(argv[3], NULL, 0) : 100000;
+  g_minSize = (argc > 4)? strtoul(argv[4], NULL, 0) : 16;
+  g_maxSize = (argc > 5)? strtoul(argv[5], NULL, 0) : 8192;
+  if (pattern < 0 || !g_threads || !g_ops || !g_minSize || g_maxSize < g_minSize) {
+    fprintf(stderr, "threadbench: invalid arguments\n");
+    return 1;
+  }
+  g_pattern = pattern;
+  // malloc and free are both sampled, churn samples once per thread started
+  size_t perThread = (g_pattern == Churn)? g_ops / ChurnBlocks + 1 : 2 * g_ops;
+  g_stride = perThread / MaxSamples + 1;
+
+  g_rings = calloc(g_threads * g_threads, sizeof(struct Ring));
+  struct Worker * workers = calloc(g_threads, sizeof(struct Worker));
+  pthread_barrier_init(&g_start, NULL, g_threads + 1);
+  for (size_t i = 0; i < g_threads; ++i) {
+    workers[i].id = i;
+    workers[i].random = 0x9e3779b97f4a7c15ull * (i + 1);
+    workers[i].samples = malloc(MaxSamples * sizeof(uint64_t));
+    pthread_create(&workers[i].thread, NULL, workerMain, &workers[i]);
+  }
+  pthread_barrier_wait(&g_start);
+  uint64_t start = now();
+  pthread_barrier_wait(&g_start);
+  uint64_t elapsed = now() - start;
+
+  uint64_t ops = 0;
+  size_t sampleCount = 0;
+  for (size_t i = 0; i < g_threads; ++i) {
+    pthread_join(workers[i].thread, NULL);
+    ops += workers[i].ops;
+    sampleCount += workers[i].sampleCount;
+  }
+  uint64_t * samples = malloc((sampleCount + 1) * sizeof(uint64_t));
+  size_t pos = 0;
+  for (size_t i = 0; i < g_threads; ++i) {
+    memcpy(samples + pos, workers[i].samples, workers[i].sampleCount * sizeof(uint64_t));
+    pos += workers[i].sampleCount;
+    free(workers[i].samples);
+  }
+  qsort(samples, sampleCount, sizeof(uint64_t), compare);
+#define PERCENTILE(p) (sampleCount? samples[(size_t)((sampleCount - 1) * (p))] : 0)
+  printf("{\"pattern\": \"%s\", \"threads\": %zu, \"ops_per_thread\": %zu, \"min_size\": %zu, \"max_size\": %zu, "
+         "\"ops\": %lu, \"seconds\": %.6f, \"ops_per_second\": %.0f, "
+         "\"p50_ns\": %lu, \"p99_ns\": %lu, \"p999_ns\": %lu, \"max_ns\": %lu}\n",
+         patternNames[g_pattern], g_threads, g_ops, g_minSize, g_maxSize,
+         (unsigned long)ops, elapsed / 1e9, ops / (elapsed / 1e9),
+         (unsigned long)PERCENTILE(0.5), (unsigned long)PERCENTILE(0.99), (unsigned long)PERCENTILE(0.999),
+         (unsigned long)(sampleCount? samples[sampleCount - 1] : 0));
+  free(samples);
+  free(workers);
+  free(g_rings);
+  return 0;
+}
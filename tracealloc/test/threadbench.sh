@@ -0,0 +1,42 @@
+#!/bin/bash
+# Sweeps threadbench over patterns and thread counts natively and with the interposer preloaded, writing a JSON array.
+# usage: threadbench.sh <libtracealloc.so> <threadbench> [output file]
+# PATTERNS (default all), THREADS the thread counts (default powers of two up to the core count),
+# OPS the operations per thread, MIN and MAX the sizes and THRESHOLD (default 4096) the TRAC_THRESHOLD.
+
+. "$(dirname "$0")/bench.sh"
+
+patterns=${PATTERNS:-local producer exchange churn}
+ops=${OPS:-100000}
+min=${MIN:-16}
+max=${MAX:-8192}
+threshold=${THRESHOLD:-4096}
+
+cores=$(nproc)
+if test -z "$THREADS"; then
+  THREADS=""
+  for ((n = 1; n < cores; n *= 2)); do
+    THREADS="$THREADS $n"
+  done
+  THREADS="$THREADS $cores"
+fi
+
+run() { # <mode> <logging> <pattern> <threads> [env...]
+  local mode=$1 logging=$2 pattern=$3 threads=$4
+  shift 4
+  measure "$(printf '"mode": "%s", "threshold": %d, "logging": %s' $mode $threshold $logging)" \
+    "$pattern $threads $ops $min $max" "$@"
+}
+
+sweep() {
+  for pattern in $patterns; do
+    for threads in $THREADS; do
+      run native false $pattern $threads
+      run preload false $pattern $threads LD_PRELOAD="$lib" TRAC_THRESHOLD=$threshold
+      rm -rf "$logdir"/*
+      run preload true $pattern $threads LD_PRELOAD="$lib" TRAC_THRESHOLD=$threshold TRAC_LOGPATH="$logdir"
+    done
+  done
+}
+
+writeJson sweep
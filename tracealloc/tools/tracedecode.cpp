@@ -0,0 +1,301 @@
+// Decodes binary allocation traces (alloc_<id>_<tid>.trc) into the text format
+//   of the former alloc_<id>_<tid>.log files understood by vis/analyze.py,
+//   sampled events (TRAC_SAMPLE_BYTES) end in ",*<weight>", allocations with a
+//   pages policy carry ",p<page size>" or ",t<page size>" (advised only) after the size
+//   and placed ones (TRAC_NUMA) end in ",@<node or i>:<node of the allocating cpu>".
+//   Regions mapped by the program (TRAC_MAPS) end in ",m<a(nonymous)|f(ile)|b(rk)>[s(hared)]",
+//   file backed ones followed by ":<offset>:<id>[,<path> from tags.log]".
+//   Prefaults (TRAC_PREFAULT) are listed as "#prefault,<time>,<base>,<ns>,<node>,<percentage>"
+//   and tags (trac_tag) as "#tag,<time>,<base>,<size>,<id>[,<name> from tags.log]".
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "trace.hpp"
+
+
+using namespace trac;
+
+class Reader
+{
+  FILE * m_in;
+  uint32_t m_encoding;
+  uint8_t m_buffer[1 << 16];
+  size_t m_pos;
+  size_t m_fill;
+  uint64_t m_prevTime;
+  uint64_t m_prevBase;
+
+  bool refill()
+  {
+    memmove(m_buffer, m_buffer + m_pos, m_fill - m_pos);
+    m_fill -= m_pos;
+    m_pos = 0;
+    m_fill += fread(m_buffer + m_fill, 1, sizeof(m_buffer) - m_fill, m_in);
+    return m_fill > 0;
+  }
+
+  bool decodeNext(Record & rec)
+  {
+    if (m_fill - m_pos < MaxEncodedRecord) {
+      refill();
+    }
+    const uint8_t * pos = m_buffer + m_pos;
+    const uint8_t * end = m_buffer + m_fill;
+    if (end - pos < 2) {
+      return false;
+    }
+    uint64_t stack, time, base, size;
+    rec.type = *pos++;
+    rec.flags = *pos++;
+    if (!(pos = getVarint(pos, end, stack)) ||
+        !(pos = getVarint(pos, end, time)) ||
+        !(pos = getVarint(pos, end, base)) ||
+        !(pos = getVarint(pos, end, size))) {
+      return false;
+    }
+    rec.stack = stack;
+    if (isEvent(rec.type)) {
+      rec.time = m_prevTime += unzigzag(time);
+      rec.base = m_prevBase += unzigzag(base);
+    } else {
+      rec.time = time;
+      rec.base = base;
+    }
+    rec.size = size;
+    m_pos = pos - m_buffer;
+    return true;
+  }
+
+public:
+  Reader(FILE * in, uint32_t encoding)
+  : m_in(in)
+  , m_encoding(encoding)
+  , m_pos(0)
+  , m_fill(0)
+  , m_prevTime(0)
+  , m_prevBase(0)
+  { }
+
+  bool next(Record & rec)
+  {
+    if (m_encoding == DeltaEncoding) {
+      return decodeNext(rec);
+    } else {
+      return fread(&rec, sizeof(rec), 1, m_in) == 1 && rec.type != EndOfTrace;
+    }
+  }
+};
+
+// Maps timestamps of a TickClock trace to nanoseconds,
+//   by linear interpolation between the first and last ClockInfo Record
+class TimeBase
+{
+  bool m_ticks;
+  Record m_first;
+  Record m_last;
+
+public:
+  TimeBase(bool ticks)
+  : m_ticks(ticks)
+  , m_first{EndOfTrace}
+  , m_last{EndOfTrace}
+  { }
+
+  void add(const Record & rec)
+  {
+    if (m_first.type == EndOfTrace) {
+      m_first = rec;
+    }
+    m_last = rec;
+  }
+
+  bool valid() const
+  {
+    return !m_ticks || m_last.time != m_first.time;
+  }
+
+  uint64_t ns(uint64_t time) const
+  {
+    if (!m_ticks || !valid()) {
+      return time;
+    }
+    __int128 dticks = (__int128)time - m_first.time;
+    __int128 ns = dticks * (__int128)(m_last.base - m_first.base) / (__int128)(m_last.time - m_first.time);
+    return m_first.base + (int64_t)ns;
+  }
+};
+
+// Frames of each stack id as printed after an event, read from stacks.log
+static std::vector<std::string> g_stacks;
+static std::vector<std::string> g_tags;
+
+// reads lines "<id>,<text>" into table[id] = ",<text>"
+static bool loadTable(const char * path, std::vector<std::string> & table)
+{
+  FILE * in = fopen(path, "r");
+  if (!in) {
+    fprintf(stderr, "%s: can not open\n", path);
+    return false;
+  }
+  char * line = nullptr;
+  size_t capacity = 0;
+  ssize_t len;
+  while ((len = getline(&line, &capacity, in)) > 0) {
+    char * frames = nullptr;
+    unsigned long id = strtoul(line, &frames, 10);
+    if (frames == line) {
+      continue;
+    }
+    if (id >= table.size()) {
+      table.resize(id + 1);
+    }
+    table[id].assign(frames, strcspn(frames, "\n"));
+  }
+  free(line);
+  fclose(in);
+  return true;
+}
+
+static void printTime(FILE * out, uint64_t ns)
+{
+  fprintf(out, "%lu.%09lu", ns / 1000000000ul, ns % 1000000000ul);
+}
+
+static bool decode(const char * path, FILE * out)
+{
+  FILE * in = fopen(path, "rb");
+  if (!in) {
+    fprintf(stderr, "%s: can not open\n", path);
+    return false;
+  }
+  TraceHeader header;
+  if (fread(&header, sizeof(header), 1, in) != 1 ||
+      memcmp(header.magic, TraceMagic, sizeof(header.magic)) != 0) {
+    fprintf(stderr, "%s: not a trace file\n", path);
+    fclose(in);
+    return false;
+  }
+  if (header.version != TraceVersion || header.recordSize != sizeof(Record) ||
+      (header.encoding != FixedEncoding && header.encoding != DeltaEncoding)) {
+    fprintf(stderr, "%s: unsupported trace version %u\n", path, header.version);
+    fclose(in);
+    return false;
+  }
+
+  Record rec;
+  TimeBase timebase(header.clock == TickClock);
+  if (header.clock == TickClock) {
+    Reader scanner(in, header.encoding);
+    while (scanner.next(rec)) {
+      if (rec.type == ClockInfo) {
+        timebase.add(rec);
+      }
+    }
+    if (!timebase.valid()) {
+      fprintf(stderr, "%s: missing clock calibration, timestamps are raw ticks\n", path);
+    }
+    fseek(in, sizeof(header), SEEK_SET);
+  }
+
+  Reader reader(in, header.encoding);
+  bool open = false; // the line of the previous event takes weight, node and mapping
+  while (reader.next(rec)) {
+    if (open && !isInfo(rec.type)) {
+      fprintf(out, "\n");
+      open = false;
+    }
+    switch (rec.type) {
+    case AllocEvent:
+    case FreeEvent:
+      fprintf(out, "%c", (rec.type == AllocEvent)? '+' : '-');
+      printTime(out, timebase.ns(rec.time));
+      fprintf(out, ",%016lx,%016lx", rec.base, rec.size);
+      if (rec.type == AllocEvent && (rec.flags & PageShiftMask)) {
+        fprintf(out, ",%c%lx", (rec.flags & TransparentPages)? 't' : 'p', 1ul << (rec.flags & PageShiftMask));
+      }
+      if (rec.stack && rec.stack < g_stacks.size()) {
+        fputs(g_stacks[rec.stack].c_str(), out);
+      }
+      open = true;
+      break;
+    case WeightInfo:
+      if (open) {
+        fprintf(out, ",*%lu", rec.size);
+      }
+      break;
+    case NodeInfo:
+      if (open) {
+        if (rec.flags & NodeInterleaved) {
+          fprintf(out, ",@i:%lu", rec.base);
+        } else {
+          fprintf(out, ",@%lu:%lu", rec.size, rec.base);
+        }
+      }
+      break;
+    case MapInfo:
+      if (open) {
+        char backing = (rec.flags & MapBreak)? 'b' : (rec.flags & MapFile)? 'f' : 'a';
+        fprintf(out, ",m%c%s", backing, (rec.flags & MapShared)? "s" : "");
+        if (rec.flags & MapFile) {
+          fprintf(out, ":%lx:%u", rec.base, rec.stack);
+          if (rec.stack && rec.stack < g_tags.size()) {
+            fputs(g_tags[rec.stack].c_str(), out);
+          }
+        }
+      }
+      break;
+    case PrefaultInfo:
+      fprintf(out, "#prefault,");
+      printTime(out, timebase.ns(rec.time));
+      fprintf(out, ",%016lx,%lu,%d,%u\n", rec.base, rec.size, (int32_t)rec.stack, rec.flags);
+      break;
+    case TagInfo:
+      fprintf(out, "#tag,");
+      printTime(out, timebase.ns(rec.time));
+      fprintf(out, ",%016lx,%016lx,%u", rec.base, rec.size, rec.stack);
+      if (rec.stack && rec.stack < g_tags.size()) {
+        fputs(g_tags[rec.stack].c_str(), out);
+      }
+      fprintf(out, "\n");
+      break;
+    case DropInfo:
+      fprintf(out, "#dropped,%lu\n", rec.size);
+      break;
+    default:
+      break;
+    }
+  }
+  if (open) {
+    fprintf(out, "\n");
+  }
+  fclose(in);
+  return true;
+}
+
+int main(int argc, char * argv[])
+{
+  int opt;
+  while ((opt = getopt(argc, argv, "s:t:")) != -1) {
+    if ((opt != 's' || !loadTable(optarg, g_stacks)) && (opt != 't' || !loadTable(optarg, g_tags))) {
+      fprintf(stderr, "Usage: tracedecode [-s <stacks.log>] [-t <tags.log>] <trace>...\n");
+      return 1;
+    }
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "Usage: tracedecode [-s <stacks.log>] [-t <tags.log>] <trace>...\n");
+    return 1;
+  }
+  int res = 0;
+  for (int i = optind; i < argc; ++i) {
+    if (!decode(argv[i], stdout)) {
+      res = 1;
+    }
+  }
+  return res;
+}
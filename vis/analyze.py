@@ -29,17 +29,78 @@ class DB:
       from_ns INTEGER(8),
       to_ns INTEGER(8),
       base UNSIGNED INTEGER(8),
-      size UNSIGNED INTEGER(8));
+      size UNSIGNED INTEGER(8),
+      weight UNSIGNED INTEGER(8),
+      page_size UNSIGNED INTEGER(8),
+      thp INTEGER,
+      node INTEGER,
+      cpu_node INTEGER,
+      name TEXT,
+      mapping TEXT,
+      file TEXT);
     CREATE INDEX IF NOT EXISTS allocs_runid_idx ON allocs(run_id);
     CREATE INDEX IF NOT EXISTS allocs_addr_idx ON allocs(base, size);
 
+    CREATE TABLE IF NOT EXISTS prefaults (
+      run_id INTEGER REFERENCES runs(id),
+      at_ns INTEGER(8),
+      base UNSIGNED INTEGER(8),
+      duration_ns INTEGER(8),
+      node INTEGER,
+      node_share INTEGER);
+    CREATE INDEX IF NOT EXISTS prefaults_runid_idx ON prefaults(run_id);
+
+    CREATE TABLE IF NOT EXISTS dirty (
+      run_id INTEGER REFERENCES runs(id),
+      at_ns INTEGER(8),
+      base UNSIGNED INTEGER(8),
+      dirty_pages INTEGER(8),
+      pages INTEGER(8));
+    CREATE INDEX IF NOT EXISTS dirty_runid_idx ON dirty(run_id);
+
+    CREATE TABLE IF NOT EXISTS residency (
+      run_id INTEGER REFERENCES runs(id),
+      at_ns INTEGER(8),
+      base UNSIGNED INTEGER(8),
+      resident_pages INTEGER(8),
+      pages INTEGER(8),
+      nodes TEXT);
+    CREATE INDEX IF NOT EXISTS residency_runid_idx ON residency(run_id);
+
+    CREATE TABLE IF NOT EXISTS tags (
+      run_id INTEGER REFERENCES runs(id),
+      at_ns INTEGER(8),
+      base UNSIGNED INTEGER(8),
+      size UNSIGNED INTEGER(8),
+      name TEXT);
+    CREATE INDEX IF NOT EXISTS tags_runid_idx ON tags(run_id);
+
+    CREATE TABLE IF NOT EXISTS regions (
+      run_id INTEGER REFERENCES runs(id),
+      at_ns INTEGER(8),
+      event TEXT,
+      name TEXT);
+    CREATE INDEX IF NOT EXISTS regions_runid_idx ON regions(run_id);
+
     CREATE TABLE IF NOT EXISTS access (
       run_id INTEGER REFERENCES runs(id),
       at_ns INTEGER(8),
       addr UNSIGNED INTEGER(8),
-      is_write INTEGER);
+      is_write INTEGER,
+      tid INTEGER,
+      alloc_base UNSIGNED INTEGER(8));
     CREATE INDEX IF NOT EXISTS access_runid_idx ON access(run_id);
     CREATE INDEX IF NOT EXISTS access_addr_idx ON access(addr);
+
+    CREATE TABLE IF NOT EXISTS heatmap (
+      run_id INTEGER REFERENCES runs(id),
+      span_ns INTEGER(8),
+      base UNSIGNED INTEGER(8),
+      block UNSIGNED INTEGER(8),
+      reads INTEGER(8),
+      writes INTEGER(8),
+      unknown INTEGER(8));
+    CREATE INDEX IF NOT EXISTS heatmap_runid_idx ON heatmap(run_id);
   """
 
   # SQL_RUN = """
@@ -68,7 +129,7 @@ class DB:
   """
 
   SQL_ALLOC_CHECK = """
-    SELECT id, from_ns, to_ns, base, size FROM allocs
+    SELECT id, from_ns, to_ns, base, size, weight, page_size, thp, node, cpu_node, mapping, file FROM allocs
     WHERE run_id = ?1
       AND base = ?3
       AND to_ns >= ?2
@@ -77,12 +138,12 @@ class DB:
     LIMIT 1;
   """
   SQL_ALLOC_INSERT = """
-    INSERT INTO allocs (run_id, from_ns, to_ns, base, size)
-    VALUES (?1, ?2, NULL, ?3, ?4);
+    INSERT INTO allocs (run_id, from_ns, to_ns, base, size, weight, page_size, thp, node, cpu_node, mapping, file)
+    VALUES (?1, ?2, NULL, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11);
   """
   SQL_ALLOC_UPDATE = """
     UPDATE allocs
-    SET from_ns = ?2, size = ?3
+    SET from_ns = ?2, size = ?3, weight = ?4, page_size = ?5, thp = ?6, node = ?7, cpu_node = ?8, mapping = ?9, file = ?10
     WHERE id = ?1;
   """
 
@@ -106,7 +167,51 @@ class DB:
   """
 
   SQL_ACCESS = """
-    INSERT INTO access (run_id, at_ns, addr, is_write)
+    INSERT INTO access (run_id, at_ns, addr, is_write, tid, alloc_base)
+    VALUES (?, ?, ?, ?, ?, ?);
+  """
+
+  SQL_HEATMAP = """
+    INSERT INTO heatmap (run_id, span_ns, base, block, reads, writes, unknown)
+    VALUES (?, ?, ?, ?, ?, ?, ?);
+  """
+
+  SQL_PREFAULT = """
+    INSERT INTO prefaults (run_id, at_ns, base, duration_ns, node, node_share)
+    VALUES (?, ?, ?, ?, ?, ?);
+  """
+
+  SQL_DIRTY = """
+    INSERT INTO dirty (run_id, at_ns, base, dirty_pages, pages)
+    VALUES (?, ?, ?, ?, ?);
+  """
+
+  SQL_RESIDENCY = """
+    INSERT INTO residency (run_id, at_ns, base, resident_pages, pages, nodes)
+    VALUES (?, ?, ?, ?, ?, ?);
+  """
+
+  SQL_TAG = """
+    INSERT INTO tags (run_id, at_ns, base, size, name)
+    VALUES (?, ?, ?, ?, ?);
+  """
+
+  # names allocations by the latest tag of their base while they were live
+  SQL_TAG_ALLOCS = """
+    UPDATE allocs
+    SET name = (
+      SELECT tags.name FROM tags
+      WHERE tags.run_id = allocs.run_id
+        AND tags.base = allocs.base
+        AND (allocs.from_ns IS NULL OR tags.at_ns >= allocs.from_ns)
+        AND (allocs.to_ns IS NULL OR tags.at_ns <= allocs.to_ns)
+      ORDER BY tags.at_ns DESC
+      LIMIT 1)
+    WHERE run_id = ?1;
+  """
+
+  SQL_REGION = """
+    INSERT INTO regions (run_id, at_ns, event, name)
     VALUES (?, ?, ?, ?);
   """
 
@@ -114,6 +219,8 @@ class DB:
     WITH mintimes(at_ns) AS (
       SELECT MIN(at_ns) FROM access WHERE run_id = ?1
       UNION ALL
+      SELECT MIN(span_ns) FROM heatmap WHERE run_id = ?1
+      UNION ALL
       SELECT MIN(from_ns) FROM allocs WHERE run_id = ?1
       UNION ALL
       SELECT min(to_ns) FROM allocs WHERE run_id = ?1)
@@ -126,6 +233,12 @@ class DB:
     WHERE run_id = ?1;
   """
 
+  SQL_TIMESTAMP_UPDATE_HEATMAP = """
+    UPDATE heatmap
+    SET span_ns = span_ns - ?2
+    WHERE run_id = ?1;
+  """
+
   SQL_TIMESTAMP_UPDATE_ALLOCS = """
     UPDATE allocs
     SET from_ns = from_ns - ?2,
@@ -133,6 +246,36 @@ class DB:
     WHERE run_id = ?1;
   """
 
+  SQL_TIMESTAMP_UPDATE_PREFAULTS = """
+    UPDATE prefaults
+    SET at_ns = at_ns - ?2
+    WHERE run_id = ?1;
+  """
+
+  SQL_TIMESTAMP_UPDATE_DIRTY = """
+    UPDATE dirty
+    SET at_ns = at_ns - ?2
+    WHERE run_id = ?1;
+  """
+
+  SQL_TIMESTAMP_UPDATE_RESIDENCY = """
+    UPDATE residency
+    SET at_ns = at_ns - ?2
+    WHERE run_id = ?1;
+  """
+
+  SQL_TIMESTAMP_UPDATE_TAGS = """
+    UPDATE tags
+    SET at_ns = at_ns - ?2
+    WHERE run_id = ?1;
+  """
+
+  SQL_TIMESTAMP_UPDATE_REGIONS = """
+    UPDATE regions
+    SET at_ns = at_ns - ?2
+    WHERE run_id = ?1;
+  """
+
 
   def __init__(self, db_file):
     self._db = sqlite3.connect(db_file)
@@ -158,20 +301,20 @@ class DB:
       self._db.commit()
       return row[0] if row is not None else None
 
-  def add_alloc(self, run_id, at_ns, base, size):
-    # print('add_alloc({},{},{},{})'.format(run_id, at_ns, base, size))
+  def add_alloc(self, run_id, at_ns, base, size, weight=None, page_size=None, thp=None, node=None, cpu_node=None, mapping=None, file=None):
+    # print('add_alloc({},{},{},{},{})'.format(run_id, at_ns, base, size, weight, page_size, thp, node, cpu_node))
     cur = self._db.execute(type(self).SQL_ALLOC_CHECK, (run_id, at_ns, base))
     row = cur.fetchone()
     if row is not None:
-      id, from_ns, to_ns, pre_base, pre_size = row
+      id, from_ns, to_ns, pre_base, pre_size, pre_weight, pre_page_size, pre_thp, pre_node, pre_cpu_node, pre_mapping, pre_file = row
       # print(' updating {:d}:   {} - {} ({} @{})'.format(id, from_ns, to_ns, pre_size, pre_base))
-      self._db.execute(type(self).SQL_ALLOC_UPDATE, (id, at_ns, size))
+      self._db.execute(type(self).SQL_ALLOC_UPDATE, (id, at_ns, size, weight, page_size, thp, node, cpu_node, mapping, file))
       if from_ns is not None:
         # print(' re-adding {} - {}  ({} @{})'.format(from_ns, None, pre_size, pre_base))
-        self._db.execute(type(self).SQL_ALLOC_INSERT, (run_id, from_ns, pre_base, pre_size))
+        self._db.execute(type(self).SQL_ALLOC_INSERT, (run_id, from_ns, pre_base, pre_size, pre_weight, pre_page_size, pre_thp, pre_node, pre_cpu_node, pre_mapping, pre_file))
     else:
       # print(' adding {} - {}  ({} @{})'.format(at_ns, None, size, base))
-      self._db.execute(type(self).SQL_ALLOC_INSERT, (run_id, at_ns, base, size))
+      self._db.execute(type(self).SQL_ALLOC_INSERT, (run_id, at_ns, base, size, weight, page_size, thp, node, cpu_node, mapping, file))
     self._db.commit()
 
   def add_free(self, run_id, at_ns, base):
@@ -190,9 +333,31 @@ class DB:
       self._db.execute(type(self).SQL_FREE_INSERT, (run_id, at_ns, base))
     self._db.commit()
 
-  def add_access(self, run_id, at_ns, addr, is_write):
+  def add_access(self, run_id, at_ns, addr, is_write, tid=None, alloc_base=None):
     # print('add_access({},{},{},{})'.format(run_id, at_ns, addr, bool(is_write)))
-    self._db.execute(type(self).SQL_ACCESS, (run_id, at_ns, addr, is_write))
+    self._db.execute(type(self).SQL_ACCESS, (run_id, at_ns, addr, is_write, tid, alloc_base))
+
+  def add_heatmap(self, run_id, span_ns, base, block, reads, writes, unknown):
+    self._db.execute(type(self).SQL_HEATMAP, (run_id, span_ns, base, block, reads, writes, unknown))
+
+  def add_prefault(self, run_id, at_ns, base, duration_ns, node, node_share):
+    self._db.execute(type(self).SQL_PREFAULT, (run_id, at_ns, base, duration_ns, node, node_share))
+
+  def add_dirty(self, run_id, at_ns, base, dirty_pages, pages):
+    self._db.execute(type(self).SQL_DIRTY, (run_id, at_ns, base, dirty_pages, pages))
+
+  def add_residency(self, run_id, at_ns, base, resident_pages, pages, nodes):
+    self._db.execute(type(self).SQL_RESIDENCY, (run_id, at_ns, base, resident_pages, pages, nodes))
+
+  def add_tag(self, run_id, at_ns, base, size, name):
+    self._db.execute(type(self).SQL_TAG, (run_id, at_ns, base, size, name))
+
+  def tag_allocs(self, run_id):
+    self._db.execute(type(self).SQL_TAG_ALLOCS, (run_id,))
+    self._db.commit()
+
+  def add_region(self, run_id, at_ns, event, name):
+    self._db.execute(type(self).SQL_REGION, (run_id, at_ns, event, name))
 
   def clean_timestamps(self, run_id):
     cur = self._db.execute(type(self).SQL_TIMESTAMP_GET, (run_id,))
@@ -200,7 +365,13 @@ class DB:
     if row is not None:
       min_ns = row[0]
       self._db.execute(type(self).SQL_TIMESTAMP_UPDATE_ACCESS, (run_id, min_ns))
+      self._db.execute(type(self).SQL_TIMESTAMP_UPDATE_HEATMAP, (run_id, min_ns))
       self._db.execute(type(self).SQL_TIMESTAMP_UPDATE_ALLOCS, (run_id, min_ns))
+      self._db.execute(type(self).SQL_TIMESTAMP_UPDATE_PREFAULTS, (run_id, min_ns))
+      self._db.execute(type(self).SQL_TIMESTAMP_UPDATE_DIRTY, (run_id, min_ns))
+      self._db.execute(type(self).SQL_TIMESTAMP_UPDATE_RESIDENCY, (run_id, min_ns))
+      self._db.execute(type(self).SQL_TIMESTAMP_UPDATE_TAGS, (run_id, min_ns))
+      self._db.execute(type(self).SQL_TIMESTAMP_UPDATE_REGIONS, (run_id, min_ns))
       self._db.commit()
 
   def commit(self):
@@ -235,22 +406,38 @@ def add_run(db, path, mr):
       max_rss = int(mt.group(6))
   return db.add_run(prog, mode, run, utime_ns, stime_ns, wtime_ns, max_rss), run == 1
 
-ALLOC_FILE_PAT = re.compile(r"^alloc_(\d+)_(\d+).log")
-ALLOC_PAT = re.compile(r"^\s*([+-])(\d+(?:\.\d+)?),([0-9a-fA-F]+),([0-9a-fA-F]+)((?:,\d+\+[0-9a-fA-F]+)*)\s*$")
-def add_allocs(db, run_id, path):
+ALLOC_FILE_PAT = re.compile(r"^alloc_(\d+)_(\d+).(log|trc)")
+ALLOC_PAT = re.compile(r"^\s*([+-])(\d+(?:\.\d+)?),([0-9a-fA-F]+),([0-9a-fA-F]+)(?:,([pt])([0-9a-fA-F]+))?((?:,\d+\+[0-9a-fA-F]+)*)(?:,\*(\d+))?(?:,@(i|\d+):(\d+))?(?:,m([abf])(s?)(?::([0-9a-fA-F]+):(\d+)(?:,(.*?))?)?)?\s*$")
+MAPPINGS = {'a': 'anon', 'f': 'file', 'b': 'brk'}
+PREFAULT_PAT = re.compile(r"^#prefault,(\d+(?:\.\d+)?),([0-9a-fA-F]+),(\d+),(-?\d+),(\d+)\s*$")
+TAG_PAT = re.compile(r"^#tag,(\d+(?:\.\d+)?),([0-9a-fA-F]+),([0-9a-fA-F]+),(\d+)(?:,(.*))?$")
+def add_allocs(db, run_id, path, decoder):
   idx = 0
   mod = 5
   def printState(mode):
     print('{:s}> Reading allocation: {:d}'.format('' if mode == 0 else '\033[G\033[K', idx), end='\n' if mode == 2 else '', flush=True)
-  for alloc_file in path.glob('alloc_*.log'):
+  for alloc_file in path.glob('alloc_*'):
     if alloc_file.is_file():
       mf = ALLOC_FILE_PAT.match(alloc_file.name)
+      if mf is None:
+        continue
       tid = None
       try:
         tid = int(mf.group(2))
       except:
         pass
-      with alloc_file.open('r') as stream:
+      if mf.group(3) == 'trc':
+        # binary traces are converted to the text format by the tracedecode tool
+        cmd = [str(decoder)]
+        if (path / 'stacks.log').is_file():
+          cmd += ['-s', str(path / 'stacks.log')]
+        if (path / 'tags.log').is_file():
+          cmd += ['-t', str(path / 'tags.log')]
+        proc = Popen(cmd + [str(alloc_file)], stdout=PIPE, text=True)
+        stream = proc.stdout
+      else:
+        stream = alloc_file.open('r')
+      with stream:
         printState(0)
         for line in stream:
           if ma := ALLOC_PAT.match(line):
@@ -260,36 +447,130 @@ def add_allocs(db, run_id, path):
             at_ns = int(float(ma.group(2)) * 1000000000)
             addr = sgx64(int(ma.group(3), 16))
             size = int(ma.group(4), 16)
-            stack = ma.group(5) and ma.group(5)[1:]
+            # page size set by a pages policy, t if huge pages were only advised
+            page_size = ma.group(6) and int(ma.group(6), 16)
+            thp = ma.group(5) and int(ma.group(5) == 't')
+            stack = ma.group(7) and ma.group(7)[1:]
+            # sampled allocations (TRAC_SAMPLE_BYTES) represent weight bytes
+            weight = ma.group(8) and int(ma.group(8))
+            # node the pages were bound to (TRAC_NUMA), -1 if interleaved, and node of the allocating cpu
+            node = ma.group(9) and (-1 if ma.group(9) == 'i' else int(ma.group(9)))
+            cpu_node = ma.group(10) and int(ma.group(10))
+            # regions mapped by the program (TRAC_MAPS), file ids without tags.log are kept as #<id>
+            mapping = ma.group(11) and MAPPINGS[ma.group(11)] + ('-shared' if ma.group(12) else '')
+            file = ma.group(14) and ma.group(14) != '0' and (ma.group(15) or '#' + ma.group(14)) or None
             # TODO-lw use tid and stack
             if ma.group(1) == '+':
-              db.add_alloc(run_id, at_ns, addr, size)
+              db.add_alloc(run_id, at_ns, addr, size, weight, page_size, thp, node, cpu_node, mapping, file)
             else:
               db.add_free(run_id, at_ns, addr)
+          elif mp := PREFAULT_PAT.match(line):
+            # pages populated by TRAC_PREFAULT helpers, node -1 if unknown
+            at_ns = int(float(mp.group(1)) * 1000000000)
+            db.add_prefault(run_id, at_ns, sgx64(int(mp.group(2), 16)), int(mp.group(3)), int(mp.group(4)), int(mp.group(5)))
+          elif mt := TAG_PAT.match(line.rstrip('\n')):
+            # names given by trac_tag, id 0 removes a name, ids without tags.log are kept as #<id>
+            at_ns = int(float(mt.group(1)) * 1000000000)
+            name = None if mt.group(4) == '0' else mt.group(5) or '#' + mt.group(4)
+            db.add_tag(run_id, at_ns, sgx64(int(mt.group(2), 16)), int(mt.group(3), 16), name)
         printState(2)
         db.commit()
 
-ACCESS_PAT = re.compile(r"(\d+(?:\.\d+)?):\s*\"?(.*?)(?::p+)?\"?:\s*([0-9a-fA-F]+)")
+# perf script lines, or lines of the software sampler (TRAC_ACCESS_RATE) which add thread and allocation
+ACCESS_PAT = re.compile(r"(\d+(?:\.\d+)?):\s*\"?(.*?)(?::p+)?\"?:\s*([0-9a-fA-F]+)(?:\s+(\d+)\s+([0-9a-fA-F]+))?")
 def add_access(db, run_id, path):
   idx = 0
   mod = 1000
   def printState(mode):
     print('{:s}> Reading access: {:d}'.format('' if mode == 0 else '\033[G\033[K', idx), end='\n' if mode == 2 else '', flush=True)
-  access_file = path / 'access.dat'
-  if access_file.is_file():
-    proc = Popen('perf script -i {} --ns -F "time,event,addr"'.format(access_file), shell=True, stdout=PIPE, text=True)
-    # might use --reltime, but then async with alloc
-    printState(0)
-    for line in proc.stdout:
+  def addLines(stream):
+    nonlocal idx
+    for line in stream:
       if ma := ACCESS_PAT.match(line):
         idx += 1
         if idx % mod == 0:
           printState(1)
         at_ns = int(float(ma.group(1)) * 1000000000)
-        is_write = 'r20016' in ma.group(2)
+        # software samples only know reads from writes on some architectures
+        is_write = None if ma.group(2) == 'sw_access' else ma.group(2) in ('r20016', 'sw_write')
         addr = sgx64(int(ma.group(3), 16))
-        db.add_access(run_id, at_ns, addr, is_write)
+        tid = ma.group(4) and int(ma.group(4))
+        alloc_base = ma.group(5) and sgx64(int(ma.group(5), 16))
+        db.add_access(run_id, at_ns, addr, is_write, tid, alloc_base)
+  access_file = path / 'access.dat'
+  if access_file.is_file():
+    proc = Popen('perf script -i {} --ns -F "time,event,addr"'.format(access_file), shell=True, stdout=PIPE, text=True)
+    # might use --reltime, but then async with alloc
+    printState(0)
+    addLines(proc.stdout)
     printState(2)
+  access_file = path / 'access.log'
+  if access_file.is_file():
+    printState(0)
+    with access_file.open('r') as stream:
+      addLines(stream)
+    printState(2)
+
+HEATMAP_PAT = re.compile(r"^(\d+(?:\.\d+)?),([0-9a-fA-F]+),([0-9a-fA-F]+),(\d+),(\d+),(\d+)\s*$")
+def add_heatmap(db, run_id, path):
+  # access counts aggregated in process (TRAC_HEATMAP), per time bucket, allocation and block
+  heatmap_file = path / 'heatmap.log'
+  if not heatmap_file.is_file():
+    return
+  print('> Reading heatmap')
+  with heatmap_file.open('r') as stream:
+    for line in stream:
+      if mh := HEATMAP_PAT.match(line):
+        span_ns = int(float(mh.group(1)) * 1000000000)
+        db.add_heatmap(run_id, span_ns, sgx64(int(mh.group(2), 16)), sgx64(int(mh.group(3), 16)),
+                       int(mh.group(4)), int(mh.group(5)), int(mh.group(6)))
+  db.commit()
+
+EPOCH_PAT = re.compile(r"^=(\d+(?:\.\d+)?)\s*$")
+DIRTY_PAT = re.compile(r"^([0-9a-fA-F]+),(\d+),(\d+)\s*$")
+def add_dirty(db, run_id, path):
+  # write working sets per soft-dirty epoch (TRAC_DIRTY_EPOCH)
+  dirty_file = path / 'dirty.log'
+  if not dirty_file.is_file():
+    return
+  print('> Reading write sets')
+  at_ns = None
+  with dirty_file.open('r') as stream:
+    for line in stream:
+      if me := EPOCH_PAT.match(line):
+        at_ns = int(float(me.group(1)) * 1000000000)
+      elif (md := DIRTY_PAT.match(line)) and at_ns is not None:
+        db.add_dirty(run_id, at_ns, sgx64(int(md.group(1), 16)), int(md.group(2)), int(md.group(3)))
+  db.commit()
+
+RESIDENCY_PAT = re.compile(r"^([0-9a-fA-F]+),(\d+),(\d+)((?:,\d+:\d+)*)\s*$")
+def add_residency(db, run_id, path):
+  # resident pages and sampled page nodes per tick (TRAC_RESIDENCY_PERIOD), nodes as "<node>:<pages>,..."
+  residency_file = path / 'residency.log'
+  if not residency_file.is_file():
+    return
+  print('> Reading residency')
+  at_ns = None
+  with residency_file.open('r') as stream:
+    for line in stream:
+      if me := EPOCH_PAT.match(line):
+        at_ns = int(float(me.group(1)) * 1000000000)
+      elif (mr := RESIDENCY_PAT.match(line)) and at_ns is not None:
+        db.add_residency(run_id, at_ns, sgx64(int(mr.group(1), 16)), int(mr.group(2)), int(mr.group(3)), mr.group(4)[1:])
+  db.commit()
+
+REGION_PAT = re.compile(r"^(\d+(?:\.\d+)?): (begin|end|pause|resume)(?:: (.*))?$")
+def add_regions(db, run_id, path):
+  # region of interest boundaries (tracealloc.h, TRAC_ROI)
+  roi_file = path / 'roi.log'
+  if not roi_file.is_file():
+    return
+  print('> Reading regions')
+  with roi_file.open('r') as stream:
+    for line in stream:
+      if mr := REGION_PAT.match(line.rstrip('\n')):
+        db.add_region(run_id, int(float(mr.group(1)) * 1000000000), mr.group(2), mr.group(3))
+  db.commit()
 
 RUN_PAT = re.compile(r"(.*)\.(\w+)\.(\d+)")
 def main(args):
@@ -308,8 +589,13 @@ def main(args):
           run_id,first = add_run(db, path, m)
           print('Processing run {:d} at {}'.format(run_id, path))
           if first or args.all:
-            add_allocs(db, run_id, path)
+            add_allocs(db, run_id, path, args.decoder)
+            db.tag_allocs(run_id)
             add_access(db, run_id, path)
+            add_heatmap(db, run_id, path)
+            add_dirty(db, run_id, path)
+            add_residency(db, run_id, path)
+            add_regions(db, run_id, path)
             print('> Normalizing timestamps')
             db.clean_timestamps(run_id)
 
@@ -331,4 +617,7 @@ if __name__ == '__main__':
   parser.add_argument('-i', '--result-dir', type=Path, required=True)
   parser.add_argument('-o', '--db-file', type=Path, required=True)
   parser.add_argument('--all', action='store_true')
+  parser.add_argument('--decoder', type=Path,
+      default=Path(__file__).resolve().parent.parent / 'tracealloc' / 'build' / 'tracedecode',
+      help="tracedecode binary used to read binary allocation traces")
   main(parser.parse_args())
@@ -152,8 +152,18 @@ class HeimdallrViz(object):
         print('Invalid run selector "{}"'.format(run_spec))
         raise SystemExit
 
+  # single access samples and those aggregated in process (TRAC_HEATMAP), weighted by count
+  SQL_SAMPLES = """
+    WITH samples(run_id, at_ns, addr, is_write, weight) AS (
+      SELECT run_id, at_ns, addr, is_write, 1 FROM access
+      UNION ALL
+      SELECT run_id, span_ns, block, 0, reads + unknown FROM heatmap WHERE reads + unknown > 0
+      UNION ALL
+      SELECT run_id, span_ns, block, 1, writes FROM heatmap WHERE writes > 0)
+  """
+
   def setup_bounds(self):
-    SQL = """
+    SQL = self.SQL_SAMPLES + """
       SELECT DISTINCT
         MAX(  base & ~(?2 - 1),                      COALESCE(?3 & ~(?2 - 1), 0x8000000000000000)) AS block_from,
         MIN(((base & ~(?2 - 1)) + size) & ~(?2 - 1), COALESCE(?4 & ~(?2 - 1), 0x7fffffffffffffff)) AS block_to
@@ -164,7 +174,7 @@ class HeimdallrViz(object):
       SELECT DISTINCT
         MAX(addr & ~(?2 - 1), COALESCE(?3 & ~(?2 - 1), 0x8000000000000000)) AS block_from,
         MIN(addr & ~(?2 - 1), COALESCE(?4 & ~(?2 - 1), 0x7fffffffffffffff)) AS block_to
-      FROM access
+      FROM samples
       WHERE run_id = ?1
         AND block_from <= block_to
       ORDER BY block_from ASC, block_to ASC;
@@ -190,9 +200,9 @@ class HeimdallrViz(object):
       self.blocks.append((cur_from, cur_to, vpos))
       self.end_block = cur_to
       self.end_vblock = vpos + cur_to - cur_from
-    SQL = """
+    SQL = self.SQL_SAMPLES + """
       SELECT MAX(at_ns - (at_ns % ?2))
-      FROM access
+      FROM samples
       WHERE run_id = ?1;
     """
     for row in self.db.execute(SQL, (self.run_id, self.time_unit)):
@@ -219,10 +229,10 @@ class HeimdallrViz(object):
     return None
 
   def get_accesses(self):
-    SQL = """
+    SQL = self.SQL_SAMPLES + """
       SELECT
-        at_ns - (at_ns % ?5) AS span, addr & ~(?2 - 1) AS block, is_write, COUNT(*) AS accesses
-      FROM access
+        at_ns - (at_ns % ?5) AS span, addr & ~(?2 - 1) AS block, is_write, SUM(weight) AS accesses
+      FROM samples
       WHERE run_id = ?1
         AND COALESCE(block >= (?3 & ~(?2 - 1)), TRUE)
         AND COALESCE(block <= ?4, TRUE)
@@ -268,7 +278,8 @@ class HeimdallrViz(object):
         from_ns - (from_ns % ?5) AS span_from,
         to_ns - (to_ns % ?5) + ?5 AS span_to,
         base & ~(?2 - 1) AS block_from,
-        ((base & ~(?2 - 1)) + size) & ~(?2 - 1) AS block_to
+        ((base & ~(?2 - 1)) + size) & ~(?2 - 1) AS block_to,
+        name
       FROM allocs
       WHERE run_id = ?1
         AND COALESCE(span_to    >= (?6 - (?6 % ?5)), TRUE)
@@ -277,14 +288,14 @@ class HeimdallrViz(object):
         AND COALESCE(block_from <= ?4, TRUE);
     """
     for row in self.db.execute(SQL, (self.run_id, self.addr_unit, self.addr_min, self.addr_max, self.time_unit, self.time_min, self.time_max)):
-      span_from, span_to, block_from, block_to = row
+      span_from, span_to, block_from, block_to, name = row
       if block_from is None or block_to is None:
         continue
       span_from_sec = (span_from or 0) / 1000000000.0
       span_to_sec = (span_to or self.end_time) / 1000000000.0
       block_size = block_to - block_from + self.addr_unit
       vblock_pos = self.get_vblock(block_from)
-      yield (span_from_sec, span_to_sec, block_from, block_from+block_size, vblock_pos, vblock_pos+block_size)
+      yield (span_from_sec, span_to_sec, block_from, block_from+block_size, vblock_pos, vblock_pos+block_size, name)
 
   def render_accesses(self):
     def on_xlim_changed(ax):
@@ -317,7 +328,7 @@ class HeimdallrViz(object):
     return axes
 
   def render_allocs(self, axes):
-    for span_from, span_to, block_from, block_to, vblock_from, vblock_to in self.get_allocs():
+    for span_from, span_to, block_from, block_to, vblock_from, vblock_to, name in self.get_allocs():
       span_from, span_to = span_from or 0, span_to or self.end_time
       vblock_from, vblock_to = vblock_from or 0, vblock_to or self.end_vblock
       orig = (span_from, vblock_from)
@@ -325,6 +336,9 @@ class HeimdallrViz(object):
       dy = vblock_to - vblock_from
       rect = patches.Rectangle(orig, dx, dy, linewidth=2, edgecolor=self.allocline, facecolor=self.allocfill, zorder=-1)
       axes.add_patch(rect)
+      # allocations named by trac_tag
+      if name is not None:
+        axes.text(span_from, vblock_to, name, size=16, color=self.allocline, va='top', clip_on=True)
 
   def render_bounds(self, axes):
     last_to = None